@@ -6,10 +6,56 @@
 #include <thread>
 #include <chrono>
 #include <cctype>
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <random>
+#include <algorithm>
+#include <string_view>
+#include <memory>
+#include <charconv>
+#include <unordered_map>
+#include <map>
+#include <list>
+#include <unordered_set>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
 
-using namespace std;
+#ifdef _WIN32
+    #include <intrin.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#ifdef __linux__
+    #include <csignal>
+    #include <sys/epoll.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #define PATIENT_HAVE_SERVER 1 // the server loop is built on epoll
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define PATIENT_HAVE_SSE2 1
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define PATIENT_HAVE_AVX2 1 // compiled per function, used if the CPU has it
+#endif
 
-const int MAX_PATIENTS = 100;
+using namespace std;
 
 // Definition of struct to store patient data
 struct Patient {
@@ -24,189 +70,5229 @@ struct Patient {
     string diagnosis;
 };
 
-// Using a two-dimensional array to meet the "Multidimensional Array" requirement
-// Second dimension is only 1, so we still store MAX_PATIENTS patients
-Patient patients[MAX_PATIENTS][1];
-int patientCount = 0;
+// Open-addressing hash table mapping a patient ID to its row in the store.
+// Linear probing over a power-of-two table of (id, row) pairs; deletion
+// shifts the following entries back instead of leaving tombstones, so
+// lookups stay O(1) on average no matter how many deletes happened.
+struct IdIndex {
+    struct Slot {
+        int id;
+        int row; // -1 marks an empty slot
+    };
 
-// Function prototypes
-void loadFromFile();
-void saveToFile();
-void addPatient();
-void diagnosePatient();
-void showAllPatients(int sortChoice, bool ascending);
-void showPatientData();
-void deletePatient();
-void updatePatient();
-void handleDataPatientMenu();
-void handleModifyPatientDataMenu();
-void handleMainMenu();
-void clear();
-void continueLoad();
-int findPatientIndexByID(int id, int idx);
-void swapPatients(int idx1, int idx2);
-void sortPatientsByID(int n, bool ascending);
-void sortPatientsByName(int n, bool ascending);
-bool isValidName(const string& name);
-bool isValidAge(const string& ageStr, int& age);
-bool isValidGender(const string& gender);
-bool isValidBloodType(const string& blood);
-string promptValidName();
-int promptValidAge();
-string promptValidGender();
-string promptValidBloodType();
-int promptValidInt(const string& prompt);
+    vector<Slot> slots;
+    size_t count = 0;
+    int shift = 64;
 
-void clear() {
-    #ifdef _WIN32
-        system("cls");
-    #else
-        system("clear");
-    #endif
+    size_t home(int id) const {
+        // Fibonacci hashing: spreads sequential IDs over the whole table
+        return (size_t)(((uint64_t)(uint32_t)id * 0x9E3779B97F4A7C15ULL) >> shift);
+    }
+
+    size_t mask() const { return slots.size() - 1; }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+        shift = 64;
+    }
+
+    // Make room for n entries without rehashing (load factor stays below 0.7)
+    void reserve(size_t n) {
+        size_t capacity = 16;
+        int bits = 4;
+        while (capacity * 7 < n * 10) {
+            capacity <<= 1;
+            bits++;
+        }
+        if (capacity <= slots.size()) return;
+
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot{0, -1});
+        shift = 64 - bits;
+        count = 0;
+        for (const Slot& s : old) {
+            if (s.row != -1) insert(s.id, s.row);
+        }
+    }
+
+    int find(int id) const {
+        if (slots.empty()) return -1;
+        size_t i = home(id);
+        while (true) {
+            const Slot& s = slots[i];
+            if (s.row == -1) return -1;
+            if (s.id == id) return s.row;
+            i = (i + 1) & mask();
+        }
+    }
+
+    // Insert id, or move it to a new row if it is already present
+    void insert(int id, int row) {
+        if ((count + 1) * 10 > slots.size() * 7) reserve(count + 1);
+        size_t i = home(id);
+        while (slots[i].row != -1 && slots[i].id != id) {
+            i = (i + 1) & mask();
+        }
+        if (slots[i].row == -1) count++;
+        slots[i].id = id;
+        slots[i].row = row;
+    }
+
+    void erase(int id) {
+        if (slots.empty()) return;
+        size_t i = home(id);
+        while (true) {
+            if (slots[i].row == -1) return;
+            if (slots[i].id == id) break;
+            i = (i + 1) & mask();
+        }
+        // Backward-shift: pull later entries of the same probe run into the hole
+        size_t hole = i;
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & mask();
+            if (slots[j].row == -1) break;
+            size_t h = home(slots[j].id);
+            // Entry j may fill the hole only if its home is not inside (hole, j]
+            bool between = (hole <= j) ? (hole < h && h <= j) : (hole < h || h <= j);
+            if (!between) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole].row = -1;
+        count--;
+    }
+};
+
+// Read-only view of a whole file. On POSIX systems the file is mapped into
+// memory, so loading never copies it; elsewhere it is read into a buffer.
+struct MappedFile {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    string buffer;
+#else
+    void* mapping = nullptr;
+#endif
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Without `populate` pages are read only when touched, in any order
+    bool open(const string& path, bool populate = true) {
+        close();
+#ifdef _WIN32
+        ifstream in(path, ios::binary);
+        if (!in.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            // Fault the whole file in with one call instead of page by page
+            if (populate) flags |= MAP_POPULATE;
+#endif
+            mapping = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                size = 0;
+                ::close(fd);
+                return false;
+            }
+            // The loader reads the file front to back exactly once; a lazy
+            // reader jumps around in it
+            madvise(mapping, size, populate ? MADV_SEQUENTIAL : MADV_RANDOM);
+            data = (const char*)mapping;
+        }
+        ::close(fd);
+        return true;
+#endif
+    }
+
+    bool holds(const char* p) const { return p >= data && p < data + size; }
+
+    // A file opened without `populate` is about to be read front to back
+    void readAhead() {
+#ifndef _WIN32
+        if (!mapping) return;
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        madvise(mapping, size, MADV_WILLNEED);
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        string().swap(buffer);
+#else
+        if (mapping) munmap(mapping, size);
+        mapping = nullptr;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// 64-bit hash over 8-byte words (multiply-xorshift). Used as the snapshot
+// checksum and for hashing strings; fast enough to run at memory speed.
+uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    h = (h ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 29);
 }
 
-void continueLoad() {
-    cout << "Press any key to continue...";
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    cin.get();
+// Set of distinct strings, each stored once in `pool`. intern() returns the
+// number of the string, counting from 0 in order of first appearance.
+// Open addressing over a power-of-two table that holds entry numbers + 1.
+// Views returned by get() are invalidated by the next intern().
+struct StringInterner {
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    string pool;
+    vector<Entry> entries;
+    vector<uint32_t> table;
+
+    uint32_t size() const { return (uint32_t)entries.size(); }
+
+    void clear() {
+        pool.clear();
+        entries.clear();
+        table.clear();
+    }
+
+    string_view get(uint32_t i) const {
+        return string_view(pool.data() + entries[i].offset, entries[i].length);
+    }
+
+    // Number of text, or -1 if it was never interned
+    long long find(string_view text) const {
+        if (table.empty()) return -1;
+        size_t mask = table.size() - 1;
+        size_t i = hashBytes(text.data(), text.size()) & mask;
+        while (table[i] != 0) {
+            if (get(table[i] - 1) == text) return table[i] - 1;
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+
+    uint32_t intern(string_view text) {
+        if ((entries.size() + 1) * 2 > table.size()) grow();
+        size_t mask = table.size() - 1;
+        size_t i = hashBytes(text.data(), text.size()) & mask;
+        while (table[i] != 0) {
+            if (get(table[i] - 1) == text) return table[i] - 1;
+            i = (i + 1) & mask;
+        }
+        uint32_t number = (uint32_t)entries.size();
+        entries.push_back(Entry{(uint32_t)pool.size(), (uint32_t)text.size()});
+        pool.append(text.data(), text.size());
+        table[i] = number + 1;
+        return number;
+    }
+
+    void grow() {
+        table.assign(table.empty() ? 64 : table.size() * 2, 0);
+        size_t mask = table.size() - 1;
+        for (uint32_t n = 0; n < entries.size(); ++n) {
+            string_view text = get(n);
+            size_t i = hashBytes(text.data(), text.size()) & mask;
+            while (table[i] != 0) i = (i + 1) & mask;
+            table[i] = n + 1;
+        }
+    }
+};
+
+// Bump allocator for text that does not come from the mapped data file
+// (typed-in values, replayed journals). Values are copied back to back into
+// 64 KB blocks that never move, so views into them stay valid until
+// clear(), and a short value costs its bytes and nothing else. Nothing is
+// freed one value at a time; a value overwritten later stays until the
+// store moves the values still in use to a new arena (compactText()).
+struct TextArena {
+    static const size_t BLOCK_BYTES = 64 << 10;
+
+    vector<unique_ptr<char[]>> blocks;
+    char* cursor = nullptr; // free space of the current block
+    size_t left = 0;
+    size_t used = 0; // bytes handed out
+
+    void clear() {
+        blocks.clear();
+        cursor = nullptr;
+        left = 0;
+        used = 0;
+    }
+
+    // n bytes of uninitialized storage
+    char* allocate(size_t n) {
+        used += n;
+        if (n > BLOCK_BYTES / 4) {
+            // Large pieces get a block of their own and the current block
+            // keeps its free space
+            blocks.emplace_back(new char[n]);
+            return blocks.back().get();
+        }
+        if (n > left) {
+            blocks.emplace_back(new char[BLOCK_BYTES]);
+            cursor = blocks.back().get();
+            left = BLOCK_BYTES;
+        }
+        char* out = cursor;
+        cursor += n;
+        left -= n;
+        return out;
+    }
+
+    string_view copy(string_view text) {
+        if (text.empty()) return string_view();
+        char* out = allocate(text.size());
+        memcpy(out, text.data(), text.size());
+        return string_view(out, text.size());
+    }
+};
+
+// Secondary index from a dictionary code to the IDs of the patients whose
+// column holds that code. Every row remembers the position of its ID inside
+// its posting list, so taking a row out is a swap with the last ID of the
+// list and costs O(1) whatever the list length.
+struct PostingIndex {
+    vector<vector<int>> lists; // code -> patient IDs
+    vector<uint32_t> slot;     // row -> position of the row's ID in its list
+
+    void clear() {
+        lists.clear();
+        slot.clear();
+    }
+
+    size_t count(uint32_t code) const { return code < lists.size() ? lists[code].size() : 0; }
+
+    const vector<int>& ids(uint32_t code) const {
+        static const vector<int> none;
+        return code < lists.size() ? lists[code] : none;
+    }
+
+    void add(int row, int patientId, uint32_t code) {
+        if (code >= lists.size()) lists.resize(code + 1);
+        if ((size_t)row >= slot.size()) slot.resize(row + 1);
+        slot[row] = (uint32_t)lists[code].size();
+        lists[code].push_back(patientId);
+    }
+
+    // Take the row out of the list of its code; `index` must still map the
+    // last ID of that list to its row
+    void remove(int row, uint32_t code, const IdIndex& index) {
+        vector<int>& list = lists[code];
+        uint32_t pos = slot[row];
+        int moved = list.back();
+        list[pos] = moved;
+        list.pop_back();
+        if (pos < list.size()) slot[index.find(moved)] = pos;
+    }
+
+    void rebuild(const vector<int>& ids, const vector<uint32_t>& codes) {
+        clear();
+        slot.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) add((int)i, ids[i], codes[i]);
+    }
+};
+
+// ASCII lower case of a name, for case-insensitive name search
+string lowerName(string_view name) {
+    string out(name);
+    for (char& c : out) c = (char)tolower((unsigned char)c);
+    return out;
+}
+
+// Distinct trigrams of a lower-case name padded as "  name ", so the first
+// letters and the end of the name get trigrams of their own. Each trigram
+// is packed into the low 24 bits of an integer.
+vector<uint32_t> nameTrigrams(string_view lower) {
+    string padded = "  " + string(lower) + " ";
+    vector<uint32_t> grams;
+    grams.reserve(padded.size());
+    for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+        grams.push_back((uint32_t)(unsigned char)padded[i] << 16 | (uint32_t)(unsigned char)padded[i + 1] << 8 |
+                        (unsigned char)padded[i + 2]);
+    }
+    sort(grams.begin(), grams.end());
+    grams.erase(unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// Name search structures, built on the first name search and then kept up
+// to date by the store. Entries are never removed: a row that was deleted
+// or renamed leaves a stale entry behind, and searches check every entry
+// against the row's current name before using it. Entry names point into
+// the store's text, which lives until the store is cleared.
+//   sorted   rows in name order, for prefix search and paged listings by
+//            binary search
+//   recent   rows named since `sorted` was built, merged into it once there
+//            are enough of them
+//   trigrams trigram -> rows whose name contains it, for fuzzy search
+struct NameIndex {
+    struct Entry {
+        uint64_t key;     // lower-case name bytes 0-7, see namePrefixKey
+        uint64_t next;    // lower-case name bytes 8-15
+        string_view name; // the row's name when the entry was made
+        int id;
+        int row;
+    };
+
+    bool built = false;
+    vector<Entry> sorted;
+    vector<int> recent;
+    unordered_map<uint32_t, vector<int>> trigrams;
+    size_t trigramEntries = 0;
+    size_t trigramEntriesAtBuild = 0;
+    vector<uint16_t> counts; // fuzzy search scratch: shared trigrams per row
+    // Searches may build or merge under a shared store lock
+    mutex lock;
+
+    void clear() {
+        built = false;
+        sorted.clear();
+        recent.clear();
+        trigrams.clear();
+        trigramEntries = trigramEntriesAtBuild = 0;
+        counts.clear();
+    }
+
+    void addTrigrams(int row, string_view lower) {
+        for (uint32_t gram : nameTrigrams(lower)) {
+            trigrams[gram].push_back(row);
+            trigramEntries++;
+        }
+    }
+
+    // Row was added or renamed
+    void add(int row, string_view name) {
+        if (!built) return;
+        recent.push_back(row);
+        addTrigrams(row, lowerName(name));
+    }
+};
+
+// Live IDs in ascending order for paged listings and ID ranges, built on
+// first use and then kept up to date by the store like NameIndex: new IDs
+// collect in `recent` until a merge, and deleted IDs stay in `sorted` until
+// then and are checked against the ID index on read.
+struct IdOrder {
+    bool built = false;
+    vector<int> sorted;
+    vector<int> recent;
+    mutex lock;
+
+    void clear() {
+        built = false;
+        sorted.clear();
+        recent.clear();
+    }
+
+    void add(int patientId) {
+        if (built) recent.push_back(patientId);
+    }
+};
+
+// Entry of AgeOrder: the age in the high half and the ID in the low half,
+// both with the sign bit flipped, so entries order by age and then ID as
+// plain integers
+inline uint64_t ageOrderKey(int age, int id) {
+    return (uint64_t)((uint32_t)age ^ 0x80000000u) << 32 | ((uint32_t)id ^ 0x80000000u);
+}
+
+inline int ageOfKey(uint64_t key) {
+    return (int)((uint32_t)(key >> 32) ^ 0x80000000u);
+}
+
+inline int idOfKey(uint64_t key) {
+    return (int)((uint32_t)key ^ 0x80000000u);
+}
+
+// Live patients ordered by age and then ID, for age ranges, listings by
+// age and the youngest and oldest patient. Kept up to date like IdOrder: a
+// patient added or given another age gets an entry in `recent`, and the
+// entries of deleted patients and of ages they no longer have stay in
+// `sorted` until the next merge and are checked against the store on read.
+struct AgeOrder {
+    bool built = false;
+    vector<uint64_t> sorted; // ageOrderKey() of each patient
+    vector<uint64_t> recent;
+    mutex lock;
+
+    void clear() {
+        built = false;
+        sorted.clear();
+        recent.clear();
+    }
+
+    void add(int patientAge, int patientId) {
+        if (built) recent.push_back(ageOrderKey(patientAge, patientId));
+    }
+};
+
+// Fields a report can group patients by. Age is grouped in brackets of
+// AGE_BRACKET_YEARS, the others by their value.
+enum GroupField { GROUP_AGE, GROUP_GENDER, GROUP_BLOOD, GROUP_DIAGNOSIS, GROUP_ADDRESS, GROUP_FIELD_COUNT };
+const char* const GROUP_FIELD_NAMES[GROUP_FIELD_COUNT] = {"age", "gender", "blood", "diagnosis", "address"};
+
+// Age brackets of reports and of their age histograms: 0-9, 10-19, ...,
+// and a last open one, 90+
+const int AGE_BRACKET_YEARS = 10;
+const int AGE_BRACKETS = 10;
+
+inline int ageBracket(int age) {
+    return min(max(age, 0) / AGE_BRACKET_YEARS, AGE_BRACKETS - 1);
+}
+
+// Group of a report: one code per grouped field, in the order the fields
+// were asked for. The code is the age bracket, the dictionary code, or for
+// addresses the number of the address in the report's own dictionary.
+// Unused parts stay 0.
+struct GroupKey {
+    uint32_t part[GROUP_FIELD_COUNT];
+
+    bool operator==(const GroupKey& other) const { return memcmp(part, other.part, sizeof(part)) == 0; }
+
+    uint64_t hash() const {
+        uint64_t h = 0;
+        for (uint32_t code : part) h = (h ^ code) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+};
+
+// Aggregates of one group
+struct GroupStats {
+    uint64_t count = 0;
+    uint64_t ageSum = 0;
+    int minAge = INT_MAX;
+    int maxAge = INT_MIN;
+    uint64_t histogram[AGE_BRACKETS] = {}; // patients per age bracket
+
+    void add(int age) {
+        count++;
+        ageSum += age;
+        minAge = min(minAge, age);
+        maxAge = max(maxAge, age);
+        histogram[ageBracket(age)]++;
+    }
+
+    void merge(const GroupStats& other) {
+        count += other.count;
+        ageSum += other.ageSum;
+        minAge = min(minAge, other.minAge);
+        maxAge = max(maxAge, other.maxAge);
+        for (int b = 0; b < AGE_BRACKETS; ++b) histogram[b] += other.histogram[b];
+    }
+
+    double meanAge() const { return count ? (double)ageSum / count : 0; }
+};
+
+// Groups of a report in an open-addressing hash table, laid out like
+// StringInterner: groups are numbered in order of first appearance and a
+// table slot holds number + 1, or 0 when free.
+struct GroupTable {
+    vector<GroupKey> keys;
+    vector<GroupStats> stats;
+    vector<uint32_t> table;
+
+    size_t size() const { return keys.size(); }
+
+    void clear() {
+        keys.clear();
+        stats.clear();
+        table.clear();
+    }
+
+    // Number of the group with this key; a new group is made if needed
+    uint32_t group(const GroupKey& key) {
+        if ((keys.size() + 1) * 2 > table.size()) grow();
+        size_t mask = table.size() - 1;
+        size_t i = key.hash() & mask;
+        while (table[i] != 0) {
+            if (keys[table[i] - 1] == key) return table[i] - 1;
+            i = (i + 1) & mask;
+        }
+        uint32_t number = (uint32_t)keys.size();
+        keys.push_back(key);
+        stats.emplace_back();
+        table[i] = number + 1;
+        return number;
+    }
+
+    // Number of the group with this key, or -1 if there is none
+    long long find(const GroupKey& key) const {
+        if (table.empty()) return -1;
+        size_t mask = table.size() - 1;
+        size_t i = key.hash() & mask;
+        while (table[i] != 0) {
+            if (keys[table[i] - 1] == key) return table[i] - 1;
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+
+    void grow() {
+        table.assign(table.empty() ? 64 : table.size() * 2, 0);
+        size_t mask = table.size() - 1;
+        for (uint32_t n = 0; n < keys.size(); ++n) {
+            size_t i = keys[n].hash() & mask;
+            while (table[i] != 0) i = (i + 1) & mask;
+            table[i] = n + 1;
+        }
+    }
+};
+
+struct PatientStore;
+
+// A report kept up to date by the store as patients are added, changed and
+// deleted, so reading it costs nothing per patient. Ages are also counted
+// one by one per group, so the minimum and maximum survive deletes.
+struct AggregateView {
+    vector<GroupField> fields;
+    GroupTable groups;
+    StringInterner addresses;
+    vector<map<int, uint32_t>> ages; // per group: age -> patients
+
+    void clear() {
+        groups.clear();
+        addresses.clear();
+        ages.clear();
+    }
+};
+
+// The store's materialized reports. They survive clear(), so a report
+// asked for once stays live across reloads; rebuild() refills them after a
+// bulk load.
+struct AggregateViews {
+    vector<AggregateView> views;
+
+    void clear() {
+        for (AggregateView& view : views) view.clear();
+    }
+
+    // Row was added, or its fields were changed, or it is about to be
+    // changed or deleted
+    void add(const PatientStore& store, int row);
+    void remove(const PatientStore& store, int row);
+
+    void rebuild(const PatientStore& store);
+};
+
+// Below this many dead rows the store is never compacted
+const size_t COMPACT_MIN_DEAD_ROWS = 1024;
+
+// Below this many bytes of overwritten text the arena is never rebuilt
+const size_t COMPACT_MIN_DEAD_TEXT = 16 << 20;
+
+// Lazily loaded data file (see openLazyPatients). The sidecar file
+// "<data>.idx" holds a LazyIndexHeader and then one LazyEntry per patient
+// of the data file, sorted by ID; a repeated ID keeps its first line, as in
+// a full load. The header ties the index to one version of the data file.
+const char LAZY_INDEX_MAGIC[8] = {'P', 'A', 'T', 'I', 'D', 'X', '0', '1'};
+
+struct LazyIndexHeader {
+    char magic[8];
+    uint64_t dataSize;  // size of the data file
+    int64_t dataMtime;  // its modification time in nanoseconds
+    uint64_t tailHash;  // hashBytes() of its last LAZY_TAIL_BYTES bytes
+    uint64_t count;     // entries that follow
+    uint64_t duplicates; // 1 if some ID has more than one line
+};
+
+struct LazyEntry {
+    int32_t id;
+    uint32_t unused;
+    uint64_t offset; // of the patient's line in the data file
+};
+
+const size_t LAZY_TAIL_BYTES = 4096;
+
+// Records read so far from a lazily loaded data file, kept until
+// LAZY_CACHE_RECORDS others were read more recently. Lookups use it under
+// a shared store lock, so it has a lock of its own.
+const size_t LAZY_CACHE_RECORDS = 4096;
+
+struct RecordCache {
+    list<Patient> order; // most recently used first
+    unordered_map<int, list<Patient>::iterator> where;
+    mutex lock;
+
+    bool get(int patientId, Patient& out) {
+        lock_guard<mutex> guard(lock);
+        auto it = where.find(patientId);
+        if (it == where.end()) return false;
+        order.splice(order.begin(), order, it->second);
+        out = order.front();
+        return true;
+    }
+
+    void put(const Patient& p) {
+        lock_guard<mutex> guard(lock);
+        auto it = where.find(p.id);
+        if (it != where.end()) order.erase(it->second);
+        order.push_front(p);
+        where[p.id] = order.begin();
+        if (order.size() > LAZY_CACHE_RECORDS) {
+            where.erase(order.back().id);
+            order.pop_back();
+        }
+    }
+
+    void erase(int patientId) {
+        lock_guard<mutex> guard(lock);
+        auto it = where.find(patientId);
+        if (it == where.end()) return;
+        order.erase(it->second);
+        where.erase(it);
+    }
+
+    void clear() {
+        lock_guard<mutex> guard(lock);
+        order.clear();
+        where.clear();
+    }
+};
+
+// State of a data file opened with --lazy. Its patients stay in the file
+// (patients.source) until one is changed: the store then takes a copy of
+// the record, which from then on hides the file's line, and IDs deleted
+// from the file are remembered in `deleted`.
+struct LazyRecords {
+    atomic<bool> active{false};
+    MappedFile sidecar;          // the index file, when it was up to date
+    vector<LazyEntry> scanned;   // the index, when the data file was scanned instead
+    const LazyEntry* entries = nullptr;
+    size_t count = 0;
+    bool duplicates = false;
+    unordered_set<int> deleted;  // IDs of the file deleted since
+    long long overlaid = 0;      // store rows whose ID the file has
+    RecordCache cache;
+    bool checked = false;        // the file has block trailers
+
+    // Blocks of the file checked so far: start offset -> -1 if intact,
+    // else the rows it held, which went to the quarantine file. Readers
+    // check blocks under a shared store lock, hence a lock of its own.
+    unordered_map<size_t, long long> blocks;
+    mutex blockLock;
+
+    // Offset of the line of patient id in the data file, or -1
+    long long offsetOf(int patientId) const {
+        const LazyEntry* end = entries + count;
+        const LazyEntry* e = lower_bound(entries, end, patientId,
+                                         [](const LazyEntry& entry, int value) { return entry.id < value; });
+        return e != end && e->id == patientId ? (long long)e->offset : -1;
+    }
+
+    // The store got a row for patient id
+    void added(int patientId) {
+        if (!active || offsetOf(patientId) < 0) return;
+        deleted.erase(patientId);
+        overlaid++;
+    }
+
+    // The store's row of patient id was deleted
+    void removed(int patientId) {
+        if (!active || offsetOf(patientId) < 0) return;
+        deleted.insert(patientId);
+        overlaid--;
+    }
+
+    void clear() {
+        active = false;
+        sidecar.close();
+        vector<LazyEntry>().swap(scanned);
+        entries = nullptr;
+        count = 0;
+        duplicates = false;
+        deleted.clear();
+        overlaid = 0;
+        cache.clear();
+        checked = false;
+        blocks.clear();
+    }
+};
+
+// Range-partitioned layout of a sharded data file (see readShardManifest).
+// Shard k holds the patients whose IDs run from first[k] up to first[k + 1]
+// and is stored in a text file of its own. A shard is read into the store
+// the first time one of its patients is needed, so the store holds either
+// all of a shard's patients or none. The flags are atomic so that readers
+// can check them before taking the store lock.
+struct ShardSet {
+    vector<int> first;        // first ID of each shard, ascending; first[0] is INT_MIN
+    vector<long long> counts; // patients in each shard's file
+    vector<long long> bytes;  // size of each shard's file
+    vector<atomic<bool>> loaded;
+    vector<atomic<bool>> dirty; // changed since its file was written
+    vector<MappedFile> files;   // loaded shards' text points in here
+
+    bool active() const { return !first.empty(); }
+
+    int count() const { return (int)first.size(); }
+
+    // The shard an ID belongs to, by binary search over the boundaries
+    int of(int patientId) const {
+        return (int)(upper_bound(first.begin(), first.end(), patientId) - first.begin()) - 1;
+    }
+
+    void setLayout(const vector<int>& firstIds) {
+        first = firstIds;
+        counts.assign(first.size(), 0);
+        bytes.assign(first.size(), 0);
+        loaded = vector<atomic<bool>>(first.size());
+        dirty = vector<atomic<bool>>(first.size());
+        files = vector<MappedFile>(first.size());
+    }
+
+    // Patient id was added, changed or deleted; its shard file is behind.
+    // Called by every mutation of the store.
+    void touch(int patientId) {
+        if (active()) dirty[of(patientId)] = true;
+    }
+
+    // Forget every shard's rows; they are read again when next needed
+    void unload() {
+        for (int k = 0; k < count(); ++k) {
+            loaded[k] = false;
+            files[k].close();
+        }
+    }
+};
+
+// A file of a sharded data file about to be written: shard `shard`'s rows,
+// or the manifest if shard is -1
+struct ShardFile {
+    int shard;
+    string text;
+    long long rows;
+};
+
+// Column-oriented storage for all patients. The fields scanned by the menu
+// queries (id, age, gender, blood type) are kept in their own contiguous
+// vectors, separate from the large text fields, so a linear pass over one
+// of them does not pull whole records through the cache. The columns grow
+// with the data, so there is no fixed patient limit.
+//
+// Gender, blood type and diagnosis take only a handful of distinct values,
+// so they are dictionary-encoded: each row holds a small integer code and
+// the text of every code is stored once in the column's dictionary. Queries
+// on these fields compare codes instead of strings.
+//
+// The other text columns hold string_views. Rows loaded from disk point
+// straight into the mapped patients file; a value typed in later is copied
+// into the text arena and the view points at that copy instead.
+//
+// Rows stay where they are across deletes: deleting a patient only clears
+// the row's bit in `live` and puts the row on a free list that the next
+// added patient reuses, so a delete costs the same at any store size. Once
+// a quarter of the rows are dead, compact() squeezes them out in one pass,
+// which renumbers the rows behind them.
+struct PatientStore {
+    // Hot columns
+    vector<int> id;
+    vector<int> age;
+    vector<uint32_t> gender;    // codes into genderDict
+    vector<uint32_t> blood;     // codes into bloodDict
+    vector<uint32_t> diagnosis; // codes into diagnosisDict
+
+    // Cold columns
+    vector<string_view> name;
+    vector<string_view> phone;
+    vector<string_view> cnic;
+    vector<string_view> address;
+
+    // Dictionaries of the encoded columns
+    StringInterner genderDict;
+    StringInterner bloodDict;
+    StringInterner diagnosisDict;
+
+    // Memory behind the text columns
+    MappedFile source;
+    TextArena text;
+    size_t deadText = 0; // arena bytes of values overwritten or deleted since
+    bool pinText = false; // views into the arena are in use outside the rows
+
+    // ID -> row lookup, kept in sync by every operation below
+    IdIndex index;
+
+    // Blood type / diagnosis code -> patient IDs, kept in sync the same way
+    PostingIndex bloodIndex;
+    PostingIndex diagnosisIndex;
+
+    // Prefix and fuzzy name search, built on first use
+    NameIndex names;
+    IdOrder idOrder;
+    AgeOrder ageOrder;
+
+    // Reports kept up to date on every change, see AggregateViews
+    AggregateViews aggregates;
+
+    // Which shards of a sharded data file are in memory
+    ShardSet shards;
+
+    // Patients of a lazily loaded data file that are still only in the file
+    LazyRecords lazy;
+
+    // Bit i % 64 of word i / 64 is set while row i holds a patient
+    vector<uint64_t> live;
+    // Dead rows waiting to be reused
+    vector<int> freeRows;
+
+    // Bumped by every mutation so derived views (sorted orders) know when
+    // they are stale
+    uint64_t version = 0;
+
+    // Number of patients
+    int size() const { return (int)(id.size() - freeRows.size()); }
+
+    // Number of rows, dead ones included; row numbers run below this
+    int rows() const { return (int)id.size(); }
+
+    void markAllLive() {
+        live.assign((id.size() + 63) / 64, ~0ULL);
+        if (id.size() % 64) live.back() = (1ULL << (id.size() % 64)) - 1;
+    }
+
+    bool isLive(int row) const { return (live[row >> 6] >> (row & 63)) & 1; }
+
+    void setLive(int row, bool on) {
+        if ((size_t)(row >> 6) >= live.size()) live.resize((row >> 6) + 1, 0);
+        if (on) {
+            live[row >> 6] |= 1ULL << (row & 63);
+        } else {
+            live[row >> 6] &= ~(1ULL << (row & 63));
+        }
+    }
+
+    int find(int patientId) const { return index.find(patientId); }
+
+    string_view genderOf(int idx) const { return genderDict.get(gender[idx]); }
+    string_view bloodOf(int idx) const { return bloodDict.get(blood[idx]); }
+    string_view diagnosisOf(int idx) const { return diagnosisDict.get(diagnosis[idx]); }
+
+    // Keep a copy of s alive for as long as the store and return a view of it
+    string_view own(string_view s) { return text.copy(s); }
+
+    // True if v points into a mapped data file rather than the arena
+    bool inFile(string_view v) const {
+        if (source.holds(v.data())) return true;
+        for (const MappedFile& file : shards.files) {
+            if (file.holds(v.data())) return true;
+        }
+        return false;
+    }
+
+    // The row's value v is about to be overwritten or dropped
+    void dropText(string_view v) {
+        if (!v.empty() && !inFile(v)) deadText += v.size();
+    }
+
+    // Overwrite a text value with a copy of value, unless it is the same
+    void setText(string_view& field, string_view value) {
+        if (field == value) return;
+        dropText(field);
+        field = own(value);
+    }
+
+    // Copy the text values the rows still use into a new arena and free the
+    // old one, once overwritten values hold half of it. The name index keeps
+    // views of its own and is built again when needed.
+    void compactText() {
+        if (pinText || deadText < COMPACT_MIN_DEAD_TEXT || deadText * 2 < text.used) return;
+        TextArena fresh;
+        for (vector<string_view>* column : {&name, &phone, &cnic, &address}) {
+            for (string_view& v : *column) {
+                if (!v.empty() && !inFile(v)) v = fresh.copy(v);
+            }
+        }
+        text = std::move(fresh);
+        deadText = 0;
+        names.clear();
+        version++;
+    }
+
+    void reserve(size_t n) {
+        id.reserve(n);
+        age.reserve(n);
+        gender.reserve(n);
+        blood.reserve(n);
+        name.reserve(n);
+        phone.reserve(n);
+        cnic.reserve(n);
+        address.reserve(n);
+        diagnosis.reserve(n);
+    }
+
+    // Drop all rows together with the memory their text points into
+    void clear() {
+        version++;
+        index.clear();
+        bloodIndex.clear();
+        diagnosisIndex.clear();
+        names.clear();
+        idOrder.clear();
+        ageOrder.clear();
+        aggregates.clear();
+        id.clear();
+        age.clear();
+        gender.clear();
+        blood.clear();
+        name.clear();
+        phone.clear();
+        cnic.clear();
+        address.clear();
+        diagnosis.clear();
+        genderDict.clear();
+        bloodDict.clear();
+        diagnosisDict.clear();
+        text.clear();
+        deadText = 0;
+        live.clear();
+        freeRows.clear();
+        lazy.clear();
+        source.close();
+        shards.unload();
+    }
+
+    // Add a row whose text already lives in memory owned by the store
+    // (fields in file order: id, name, age, gender, blood, phone, cnic,
+    // address, diagnosis; the numeric ones are passed parsed) and return its
+    // number. A dead row is reused if there is one. The indexes are not
+    // touched: bulk loads call rebuildIndex() once at the end.
+    int appendViews(int patientId, int patientAge, const string_view fields[9]) {
+        version++;
+        lazy.added(patientId);
+        if (!freeRows.empty()) {
+            int row = freeRows.back();
+            freeRows.pop_back();
+            id[row] = patientId;
+            age[row] = patientAge;
+            name[row] = fields[1];
+            gender[row] = genderDict.intern(fields[3]);
+            blood[row] = bloodDict.intern(fields[4]);
+            phone[row] = fields[5];
+            cnic[row] = fields[6];
+            address[row] = fields[7];
+            diagnosis[row] = diagnosisDict.intern(fields[8]);
+            setLive(row, true);
+            return row;
+        }
+        id.push_back(patientId);
+        age.push_back(patientAge);
+        name.push_back(fields[1]);
+        gender.push_back(genderDict.intern(fields[3]));
+        blood.push_back(bloodDict.intern(fields[4]));
+        phone.push_back(fields[5]);
+        cnic.push_back(fields[6]);
+        address.push_back(fields[7]);
+        diagnosis.push_back(diagnosisDict.intern(fields[8]));
+        setLive(rows() - 1, true);
+        return rows() - 1;
+    }
+
+    // Insert a row, or overwrite the row that already has this ID
+    void upsertViews(int patientId, int patientAge, const string_view fields[9]) {
+        shards.touch(patientId);
+        int row = find(patientId);
+        if (row == -1) {
+            indexRow(appendViews(patientId, patientAge, fields));
+            return;
+        }
+        unindexCodes(row);
+        version++;
+        if (age[row] != patientAge) ageOrder.add(patientAge, patientId);
+        age[row] = patientAge;
+        if (name[row] != fields[1]) names.add(row, fields[1]);
+        for (string_view field : {name[row], phone[row], cnic[row], address[row]}) dropText(field);
+        name[row] = fields[1];
+        gender[row] = genderDict.intern(fields[3]);
+        blood[row] = bloodDict.intern(fields[4]);
+        phone[row] = fields[5];
+        cnic[row] = fields[6];
+        address[row] = fields[7];
+        diagnosis[row] = diagnosisDict.intern(fields[8]);
+        indexCodes(row);
+        compactText();
+    }
+
+    // Add a patient and return its row
+    int append(const Patient& p) {
+        string_view fields[9];
+        fields[1] = own(p.name);
+        fields[3] = p.gender;
+        fields[4] = p.blood;
+        fields[5] = own(p.phone);
+        fields[6] = own(p.cnic);
+        fields[7] = own(p.address);
+        fields[8] = p.diagnosis;
+        shards.touch(p.id);
+        int row = appendViews(p.id, p.age, fields);
+        indexRow(row);
+        return row;
+    }
+
+    // Enter a new row in the ID index, the code indexes and the listing
+    // orders
+    void indexRow(int row) {
+        index.insert(id[row], row);
+        indexCodes(row);
+        names.add(row, name[row]);
+        idOrder.add(id[row]);
+        ageOrder.add(age[row], id[row]);
+    }
+
+    void indexCodes(int row) {
+        bloodIndex.add(row, id[row], blood[row]);
+        diagnosisIndex.add(row, id[row], diagnosis[row]);
+        aggregates.add(*this, row);
+    }
+
+    // Take a row out of the code indexes and the reports before its fields
+    // or ID change
+    void unindexCodes(int row) {
+        bloodIndex.remove(row, blood[row], index);
+        diagnosisIndex.remove(row, diagnosis[row], index);
+        aggregates.remove(*this, row);
+    }
+
+    // Rebuild the ID index from the id column in one tight pass, then the
+    // code indexes. Dead rows are dropped, and when an ID occurs more than
+    // once only its first row is kept, so afterwards every row is live.
+    // Returns the number of rows dropped as duplicates. Bulk loads fill the
+    // columns directly and call this once at the end.
+    int rebuildIndex() {
+        // Only rows on the free list are dead; bulk loads leave the bitmap alone
+        if (freeRows.empty()) markAllLive();
+
+        index.clear();
+        index.reserve(size());
+        vector<int> duplicates;
+        for (int i = 0; i < rows(); ++i) {
+            if (!isLive(i)) continue;
+            if (index.find(id[i]) != -1) {
+                duplicates.push_back(i);
+            } else {
+                index.insert(id[i], i);
+            }
+        }
+        if (!duplicates.empty() || !freeRows.empty()) {
+            // Compact the columns over dead and duplicate rows, then index again
+            for (int row : duplicates) setLive(row, false);
+            int kept = 0;
+            for (int i = 0; i < rows(); ++i) {
+                if (!isLive(i)) continue;
+                id[kept] = id[i];
+                age[kept] = age[i];
+                gender[kept] = gender[i];
+                blood[kept] = blood[i];
+                name[kept] = name[i];
+                phone[kept] = phone[i];
+                cnic[kept] = cnic[i];
+                address[kept] = address[i];
+                diagnosis[kept] = diagnosis[i];
+                kept++;
+            }
+            id.resize(kept);
+            age.resize(kept);
+            gender.resize(kept);
+            blood.resize(kept);
+            name.resize(kept);
+            phone.resize(kept);
+            cnic.resize(kept);
+            address.resize(kept);
+            diagnosis.resize(kept);
+            freeRows.clear();
+            markAllLive();
+            index.clear();
+            index.reserve(kept);
+            for (int i = 0; i < kept; ++i) index.insert(id[i], i);
+        }
+        bloodIndex.rebuild(id, blood);
+        diagnosisIndex.rebuild(id, diagnosis);
+        aggregates.rebuild(*this);
+        // Rows may have moved; the listing orders are built again when needed
+        names.clear();
+        idOrder.clear();
+        ageOrder.clear();
+        version++;
+        return (int)duplicates.size();
+    }
+
+    // Index the rows from `from` on, which a bulk load appended to the
+    // columns without marking them live. A row whose ID is already in the
+    // store is dropped. Cheaper than rebuildIndex() when the store already
+    // holds many rows, since those are left alone. Returns the number of
+    // rows dropped.
+    int indexNewRows(int from) {
+        index.reserve(size() + (rows() - from));
+        int dropped = 0;
+        for (int row = from; row < rows(); ++row) {
+            if (index.find(id[row]) != -1) {
+                name[row] = phone[row] = cnic[row] = address[row] = string_view();
+                setLive(row, false);
+                freeRows.push_back(row);
+                dropped++;
+                continue;
+            }
+            setLive(row, true);
+            index.insert(id[row], row);
+            indexCodes(row);
+        }
+        // The listing orders are built again when needed
+        names.clear();
+        idOrder.clear();
+        ageOrder.clear();
+        version++;
+        return dropped;
+    }
+
+    // Assemble a full record from the columns of one row
+    Patient get(int idx) const {
+        Patient p;
+        p.id = id[idx];
+        p.name = string(name[idx]);
+        p.age = age[idx];
+        p.gender = string(genderOf(idx));
+        p.blood = string(bloodOf(idx));
+        p.phone = string(phone[idx]);
+        p.cnic = string(cnic[idx]);
+        p.address = string(address[idx]);
+        p.diagnosis = string(diagnosisOf(idx));
+        return p;
+    }
+
+    // Overwrite one row with a full record; only changed fields get copied
+    void set(int idx, const Patient& p) {
+        version++;
+        shards.touch(id[idx]);
+        shards.touch(p.id);
+        unindexCodes(idx);
+        bool renamed = name[idx] != p.name || id[idx] != p.id;
+        if (id[idx] != p.id) {
+            index.erase(id[idx]);
+            index.insert(p.id, idx);
+            idOrder.add(p.id);
+        }
+        if (id[idx] != p.id || age[idx] != p.age) ageOrder.add(p.age, p.id);
+        id[idx] = p.id;
+        age[idx] = p.age;
+        gender[idx] = genderDict.intern(p.gender);
+        blood[idx] = bloodDict.intern(p.blood);
+        setText(name[idx], p.name);
+        // Name entries carry the ID too
+        if (renamed) names.add(idx, name[idx]);
+        setText(phone[idx], p.phone);
+        setText(cnic[idx], p.cnic);
+        setText(address[idx], p.address);
+        diagnosis[idx] = diagnosisDict.intern(p.diagnosis);
+        indexCodes(idx);
+        compactText();
+    }
+
+    void setDiagnosis(int idx, string_view diag) {
+        version++;
+        shards.touch(id[idx]);
+        diagnosisIndex.remove(idx, diagnosis[idx], index);
+        aggregates.remove(*this, idx);
+        diagnosis[idx] = diagnosisDict.intern(diag);
+        diagnosisIndex.add(idx, id[idx], diagnosis[idx]);
+        aggregates.add(*this, idx);
+    }
+
+    // Remove one row in O(1): mark it dead and keep it for the next added
+    // patient. Its text views are dropped so they keep nothing alive.
+    void erase(int idx) {
+        version++;
+        shards.touch(id[idx]);
+        lazy.removed(id[idx]);
+        unindexCodes(idx);
+        index.erase(id[idx]);
+        for (string_view field : {name[idx], phone[idx], cnic[idx], address[idx]}) dropText(field);
+        name[idx] = phone[idx] = cnic[idx] = address[idx] = string_view();
+        setLive(idx, false);
+        freeRows.push_back(idx);
+        if (freeRows.size() >= COMPACT_MIN_DEAD_ROWS && freeRows.size() * 4 >= id.size()) compact();
+        compactText();
+    }
+
+    // Drop every dead row, keeping the order of the others. Row numbers of
+    // the patients behind a dead row change.
+    void compact() {
+        if (!freeRows.empty()) rebuildIndex();
+    }
+
+    // Drop the rows from n on. Only for bulk loads, before rebuildIndex().
+    void truncateRows(int n) {
+        if (n >= rows()) return;
+        id.resize(n);
+        age.resize(n);
+        gender.resize(n);
+        blood.resize(n);
+        name.resize(n);
+        phone.resize(n);
+        cnic.resize(n);
+        address.resize(n);
+        diagnosis.resize(n);
+    }
+};
+
+PatientStore patients;
+
+// File the patient data is loaded from and saved to
+string dataFilePath = "patients.txt";
+
+// False in batch mode: no screen clearing and no waiting for the user
+bool interactive = true;
+
+// Threads used to parse a text data file and to run reports; 0 means one per
+// hardware thread
+int loaderThreads = 0;
+
+// Rows of the last loaded data file that failed their block check
+long long quarantinedRows = 0;
+
+// Number of shards to split the data file into, from "--shards"; 0 keeps
+// it whole
+int requestedShards = 0;
+
+// Open a text data file lazily, reading records when they are needed
+// ("--lazy")
+bool lazyStartup = false;
+
+// Binary snapshot format, used for data files whose name ends in ".bin".
+// Everything is stored little-endian, in sections padded to 8 bytes:
+//   header      BinarySnapshotHeader
+//   id, age     int32[rows] each
+//   codes       uint32[rows] each for gender, blood and diagnosis
+//   text        BinaryTextRef[rows] each for name, phone, cnic and address
+//   dictionary  BinaryTextRef per value of the gender, blood and diagnosis
+//               dictionaries, in code order
+//   pool        the bytes of every distinct string, stored once
+// The checksum covers everything after the header. Loading is a single
+// mapping plus column copies; nothing is parsed per record.
+struct BinarySnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t textColumns;
+    uint64_t rows;
+    uint64_t poolBytes;
+    uint64_t checksum;
+    uint32_t dictionaryValues[3];
+    uint32_t padding;
+    uint64_t reserved;
+};
+
+struct BinaryTextRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+static_assert(sizeof(BinarySnapshotHeader) == 64, "snapshot header must stay 64 bytes");
+
+const char BINARY_SNAPSHOT_MAGIC[8] = {'P', 'M', 'S', 'N', 'A', 'P', '\r', '\n'};
+// Version 2 stores gender, blood and diagnosis as dictionary codes
+const uint32_t BINARY_SNAPSHOT_VERSION = 2;
+const int BINARY_TEXT_COLUMNS = 4;
+const int BINARY_CODE_COLUMNS = 3;
+
+// Append-only journal of patient changes, kept next to the data file as
+// "<data file>.wal". Each change is one line: "+|<record>" for an added or
+// edited patient and "-|<id>" for a deleted one, so the cost of recording a
+// change does not depend on how many patients there are. Loading replays the
+// journal over the data file. Once the journal grows past the size of the
+// data file it is rotated to "<data file>.wal.old" and a background thread
+// writes a fresh data file (a snapshot) that makes both logs redundant.
+//
+// Changes never wait for the disk. The store operations only queue their
+// record in `pending` and go on; a writer thread takes everything queued
+// since its last write and hands it to the OS in one write (group commit),
+// syncing per JOURNAL_SYNC_RECORDS / JOURNAL_SYNC_INTERVAL_MS. Without a
+// journal a change only marks the data file as behind, and the writer
+// rewrites it once per JOURNAL_REWRITE_DELAY_MS however many changes came
+// in. waitForPersistence() is the barrier: it returns once everything
+// queued before it is on disk.
+struct Journal {
+    bool enabled = true;
+    FILE* file = nullptr;
+    long long bytes = 0;         // size of the active journal
+    long long snapshotBytes = 0; // size of the data file it applies to
+    thread compactor;
+    atomic<bool> compacting{false};
+
+    // Writer thread and its queue, guarded by queueLock
+    thread writer;
+    mutex queueLock;
+    condition_variable wake;    // work was queued, or a barrier or stop waits
+    condition_variable written; // the writer finished a round
+    string pending;             // records not yet handed to the OS
+    long long pendingRecords = 0;
+    bool rewritePending = false; // the data file is behind the store
+    uint64_t rewriteSeq = 0;     // first change the rewrite is for
+    std::chrono::steady_clock::time_point rewriteDue;
+    bool writing = false;       // the writer is using `file`
+    bool fileHeld = false;      // another thread took `file`, see holdJournalFile()
+    long long unsyncedRecords = 0; // written to `file` since its last sync
+    bool syncRequested = false;
+    bool stopping = false;
+    bool failed = false;        // a write failed since the last barrier
+    uint64_t queuedSeq = 0;     // changes queued so far
+    uint64_t durableSeq = 0;    // changes on disk
+
+    ~Journal();
+};
+
+Journal journal;
+
+// fsync batching: the writer syncs the journal after this many records, or
+// once this long has passed since the previous sync, whichever first
+const int JOURNAL_SYNC_RECORDS = 64;
+const int JOURNAL_SYNC_INTERVAL_MS = 100;
+// Without a journal, changes this close together share one rewrite
+const int JOURNAL_REWRITE_DELAY_MS = 200;
+// The journal is never compacted before it reaches this size
+const long long JOURNAL_MIN_COMPACT_BYTES = 1 << 20;
+
+// Runtime statistics: how often each operation ran, how long it took and
+// how much data moved. Every thread counts into its own block with plain
+// relaxed loads and stores, so the hot paths never share a cache line or
+// take a lock; the blocks are only summed when someone asks. Each thread
+// times the first STATS_TIME_FIRST calls of an operation and then one in
+// STATS_SAMPLE_EVERY, which keeps the clock reads off busy paths while an
+// interactive session still has every call timed.
+enum StatOp { STAT_LOOKUP, STAT_ADD, STAT_UPDATE, STAT_DELETE, STAT_SAVE, STAT_LOAD, STAT_OP_COUNT };
+const char* const STAT_OP_NAMES[STAT_OP_COUNT] = {"lookup", "add", "update", "delete", "save", "load"};
+const uint64_t STATS_TIME_FIRST = 1024;
+const uint64_t STATS_SAMPLE_EVERY = 64;
+
+// Latency buckets: four per power of two nanoseconds, so a bucket's upper
+// bound is at most 25% above any latency in it
+const int LATENCY_BUCKETS = 256;
+
+int latencyBucket(uint64_t ns) {
+    if (ns < 4) return (int)ns;
+#ifdef _MSC_VER
+    unsigned long top;
+    _BitScanReverse64(&top, ns);
+    int msb = (int)top;
+#else
+    int msb = 63 - __builtin_clzll(ns);
+#endif
+    return min(msb * 4 + (int)((ns >> (msb - 2)) & 3), LATENCY_BUCKETS - 1);
+}
+
+// Smallest latency that falls above bucket b
+uint64_t latencyBucketLimit(int b) {
+    if (b < 4) return (uint64_t)b + 1;
+    int msb = b / 4;
+    return (uint64_t)(4 + b % 4 + 1) << (msb - 2);
+}
+
+struct ThreadStats {
+    atomic<uint64_t> calls[STAT_OP_COUNT] = {};
+    atomic<uint64_t> sampled[STAT_OP_COUNT] = {};
+    atomic<uint64_t> sampledNs[STAT_OP_COUNT] = {};
+    atomic<uint64_t> latency[STAT_OP_COUNT][LATENCY_BUCKETS] = {};
+    atomic<uint64_t> bytesRead{0}, bytesWritten{0};
+    atomic<uint64_t> recordsRead{0}, recordsWritten{0};
+
+    // Only the owning thread writes, so no read-modify-write is needed
+    static void bump(atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+};
+
+struct RuntimeStats {
+    bool enabled = true;
+    mutex lock;
+    vector<unique_ptr<ThreadStats>> threads; // never freed: threads may outlive a dump
+};
+
+RuntimeStats stats;
+
+ThreadStats& threadStats() {
+    thread_local ThreadStats* mine = nullptr;
+    if (!mine) {
+        lock_guard<mutex> guard(stats.lock);
+        stats.threads.push_back(unique_ptr<ThreadStats>(new ThreadStats()));
+        mine = stats.threads.back().get();
+    }
+    return *mine;
+}
+
+// Count one operation, timing it if it is this thread's sample. Construct
+// at the start of the operation; the count is taken when it goes out of
+// scope.
+class StatTimer {
+public:
+    explicit StatTimer(StatOp op) : op(op) {
+        if (!stats.enabled) return;
+        ThreadStats& mine = threadStats();
+        uint64_t calls = mine.calls[op].load(memory_order_relaxed);
+        ThreadStats::bump(mine.calls[op], 1);
+        if (calls < STATS_TIME_FIRST || calls % STATS_SAMPLE_EVERY == 0 || op >= STAT_SAVE) {
+            timed = true;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~StatTimer() {
+        if (!timed) return;
+        uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start).count();
+        ThreadStats& mine = threadStats();
+        ThreadStats::bump(mine.sampled[op], 1);
+        ThreadStats::bump(mine.sampledNs[op], ns);
+        ThreadStats::bump(mine.latency[op][latencyBucket(ns)], 1);
+    }
+
+    StatTimer(const StatTimer&) = delete;
+    StatTimer& operator=(const StatTimer&) = delete;
+
+private:
+    StatOp op;
+    bool timed = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+void countBytesRead(uint64_t bytes, uint64_t records) {
+    if (!stats.enabled) return;
+    ThreadStats& mine = threadStats();
+    ThreadStats::bump(mine.bytesRead, bytes);
+    ThreadStats::bump(mine.recordsRead, records);
+}
+
+void countBytesWritten(uint64_t bytes, uint64_t records) {
+    if (!stats.enabled) return;
+    ThreadStats& mine = threadStats();
+    ThreadStats::bump(mine.bytesWritten, bytes);
+    ThreadStats::bump(mine.recordsWritten, records);
+}
+
+// Totals over all threads, as shown by the Statistics screen
+struct StatsSnapshot {
+    uint64_t calls[STAT_OP_COUNT] = {};
+    uint64_t sampled[STAT_OP_COUNT] = {};
+    uint64_t sampledNs[STAT_OP_COUNT] = {};
+    uint64_t latency[STAT_OP_COUNT][LATENCY_BUCKETS] = {};
+    uint64_t bytesRead = 0, bytesWritten = 0, recordsRead = 0, recordsWritten = 0;
+
+    // Latency at quantile q (0-1) of the timed operations, in ns, rounded
+    // up to its bucket's limit; 0 if none were timed
+    uint64_t quantile(int op, double q) const {
+        if (sampled[op] == 0) return 0;
+        uint64_t rank = (uint64_t)(q * (sampled[op] - 1)) + 1, seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; ++b) {
+            seen += latency[op][b];
+            if (seen >= rank) return latencyBucketLimit(b);
+        }
+        return latencyBucketLimit(LATENCY_BUCKETS - 1);
+    }
+
+    double meanNs(int op) const {
+        return sampled[op] ? (double)sampledNs[op] / sampled[op] : 0;
+    }
+};
+
+StatsSnapshot snapshotStats() {
+    StatsSnapshot total;
+    lock_guard<mutex> guard(stats.lock);
+    for (const unique_ptr<ThreadStats>& t : stats.threads) {
+        for (int op = 0; op < STAT_OP_COUNT; ++op) {
+            total.calls[op] += t->calls[op].load(memory_order_relaxed);
+            total.sampled[op] += t->sampled[op].load(memory_order_relaxed);
+            total.sampledNs[op] += t->sampledNs[op].load(memory_order_relaxed);
+            for (int b = 0; b < LATENCY_BUCKETS; ++b) total.latency[op][b] += t->latency[op][b].load(memory_order_relaxed);
+        }
+        total.bytesRead += t->bytesRead.load(memory_order_relaxed);
+        total.bytesWritten += t->bytesWritten.load(memory_order_relaxed);
+        total.recordsRead += t->recordsRead.load(memory_order_relaxed);
+        total.recordsWritten += t->recordsWritten.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+// The statistics as one line of JSON. Latencies are in nanoseconds.
+string statsJson() {
+    StatsSnapshot s = snapshotStats();
+    string json = "{\"enabled\": " + string(stats.enabled ? "true" : "false") + ", \"operations\": {";
+    for (int op = 0; op < STAT_OP_COUNT; ++op) {
+        char line[256];
+        snprintf(line, sizeof line,
+                 "%s\"%s\": {\"count\": %llu, \"timed\": %llu, \"mean_ns\": %.0f, \"p50_ns\": %llu, "
+                 "\"p99_ns\": %llu, \"max_ns\": %llu}",
+                 op ? ", " : "", STAT_OP_NAMES[op], (unsigned long long)s.calls[op], (unsigned long long)s.sampled[op],
+                 s.meanNs(op), (unsigned long long)s.quantile(op, 0.5), (unsigned long long)s.quantile(op, 0.99),
+                 (unsigned long long)s.quantile(op, 1.0));
+        json += line;
+    }
+    json += "}, \"bytes_read\": " + to_string(s.bytesRead) + ", \"bytes_written\": " + to_string(s.bytesWritten) +
+            ", \"records_read\": " + to_string(s.recordsRead) + ", \"records_written\": " + to_string(s.recordsWritten) +
+            "}";
+    return json;
+}
+
+// Reader/writer lock that lets a waiting writer in ahead of new readers.
+// std::shared_mutex on glibc prefers readers, so a steady stream of lookups
+// would keep writers out forever. Readers pay one extra atomic load.
+struct StoreLock {
+    shared_mutex rw;
+    atomic<int> waitingWriters{0};
+
+    void lock() {
+        waitingWriters++;
+        rw.lock();
+        waitingWriters--;
+    }
+    void unlock() { rw.unlock(); }
+
+    void lock_shared() {
+        while (waitingWriters.load(memory_order_acquire) > 0) std::this_thread::yield();
+        rw.lock_shared();
+    }
+    void unlock_shared() { rw.unlock_shared(); }
+};
+
+// Lock of the store for code that may run on several threads. Lookups,
+// listings and queries hold it shared and run side by side; add, update,
+// diagnose and delete hold it exclusively for the in-memory change and its
+// journal record only, never while waiting for the user.
+StoreLock storeMutex;
+
+// Outcome of a store operation
+enum StoreStatus {
+    STORE_OK,
+    STORE_NOT_FOUND,     // no patient with that ID
+    STORE_DUPLICATE_ID,  // the ID is already registered
+    STORE_HAS_DIAGNOSIS  // diagnose on a patient that already has one
+};
+
+// Function prototypes
+void loadFromFile();
+void saveToFile();
+bool writeDataFile();
+int loadPatientsFile(const string& path);
+int loadThreadCount(size_t bytes);
+void parsePatientsParallel(int threads, vector<string_view>& damaged, size_t& damagedRows);
+bool replaceFile(const string& from, const string& to);
+bool syncFile(FILE* file);
+void syncDirectoryOf(const string& path);
+void quarantineBlocks(const string& path, const vector<string_view>& blocks);
+void appendPatientLine(string& out, int row);
+void appendTextBlocks(string& out, const vector<int>& rows);
+bool writeFileAtomically(const string& path, const string& contents);
+bool writePatientsFile(const string& path, long long& bytesWritten);
+bool isBinaryDataPath(const string& path);
+vector<string_view>* snapshotTextColumn(int k);
+vector<uint32_t>* snapshotCodeColumn(int k);
+StringInterner* snapshotDictionary(int k);
+uint64_t hashBytes(const char* data, size_t size);
+string buildBinarySnapshot();
+string buildTextSnapshot();
+int loadBinarySnapshot();
+bool convertPatientsFile(const string& from, const string& to);
+string shardManifestPath();
+string shardPath(int k);
+int readShardManifest();
+string shardManifestText();
+long long shardBytes();
+void splitIntoShards(int count);
+void loadShards(const vector<int>& which);
+void loadShardOf(int id);
+void loadAllShards();
+void prepareShardOf(int id);
+void prepareAllPatients();
+long long patientCount();
+string lazyIndexPath(const string& dataPath);
+bool fileStamp(const string& path, uint64_t& size, int64_t& mtime);
+bool parseLineId(string_view line, int& id);
+bool scanLazyIndex(const char* data, size_t size, vector<LazyEntry>& entries);
+bool writeLazyIndex(const string& dataPath, const char* data, size_t size, const vector<LazyEntry>& entries,
+                    bool duplicates);
+void refreshLazyIndex(const string& dataPath);
+long long openLazyPatients(const string& path);
+size_t lazyBlockEnd(size_t offset);
+size_t lazyBlockStart(size_t offset);
+bool lazyBlockIntact(size_t start, size_t end);
+bool readLazyPatient(int id, Patient& out);
+void hydratePatient(int id);
+void hydrateAllPatients();
+void loadPatientOf(int id);
+vector<ShardFile> buildShardFiles();
+bool writeShardFiles(const vector<ShardFile>& files);
+string journalPath();
+string journalOldPath();
+void openJournal();
+int replayJournalFile(const string& path);
+void journalAppend(const string& record);
+void startJournalWriter();
+void journalWriterLoop();
+void requestDataFileRewrite();
+void rewriteDataFileFromWriter();
+void waitForJournalWrites();
+void holdJournalFile();
+void releaseJournalFile(bool ok);
+void closeJournal();
+bool waitForPersistence();
+void journalUpsert(int row);
+void journalDelete(int id);
+void startJournalCompaction();
+void compactJournal(string oldPath, string dataPath);
+void resetJournal(long long snapshotBytes);
+void persistPatient(int row);
+void persistDeletion(int id);
+bool lookupPatient(int id, Patient& out);
+StoreStatus insertPatient(Patient p);
+StoreStatus replacePatient(int id, Patient p);
+StoreStatus diagnosePatientRecord(int id, const string& diagnosis);
+StoreStatus removePatient(int id);
+vector<string_view> splitFields(string_view line, int maxFields);
+bool applyBatchCommand(string_view line, string& error);
+int runBatch(const string& path);
+void handleServerRequest(string_view line, string& out);
+int runServer(const string& socketPath);
+int runLoadGenerator(const string& socketPath, long long total, int connections, int depth);
+double secondsSince(std::chrono::steady_clock::time_point start);
+void addPatient();
+void diagnosePatient();
+void showAllPatients(int sortChoice, bool ascending);
+void showPatientData();
+void filterPatients();
+void searchPatientsByName();
+void showPatientsInRange();
+void showPatientReports();
+void showStatistics();
+void deletePatient();
+void updatePatient();
+void handleDataPatientMenu();
+void handleModifyPatientDataMenu();
+void handleMainMenu();
+void clear();
+void continueLoad();
+int findPatientIndexByID(int id);
+bool isValidName(const string& name);
+bool isValidAge(const string& ageStr, int& age);
+bool isValidGender(const string& gender);
+bool isValidBloodType(const string& blood);
+string promptValidName();
+int promptValidAge();
+string promptValidGender();
+string promptValidBloodType();
+int promptValidInt(const string& prompt);
+Patient makeSyntheticPatient(int i, mt19937& rng);
+void fillSyntheticStore(int n);
+string formatPatientLine(const Patient& p);
+long long writeSyntheticFile(const string& path, long long targetBytes, long long maxRows = LLONG_MAX);
+void dropFileCache(const string& path);
+void benchLookup(const vector<int>& sizes);
+void benchPages(const vector<int>& sizes);
+void benchLoad(long long megabytes);
+void benchParallelLoad(long long megabytes);
+void benchJournal(const vector<int>& sizes);
+void benchPersist(int n);
+void benchFormats(int n);
+void benchSave(int n);
+void benchShards(int n);
+void benchLazy(long long megabytes);
+void benchDictionary(int n);
+void benchScan(int n);
+void benchConcurrency(int n);
+void benchDelete(const vector<int>& sizes);
+void benchMemory(int n);
+void benchNames(const vector<int>& sizes);
+void benchSuite(const vector<int>& sizes);
+void benchStats(int n);
+void benchGroupBy(int n);
+void benchRange(int n);
+void runBenchmark(int argc, char* argv[]);
+
+void clear() {
+    if (!interactive) return;
+    #ifdef _WIN32
+        system("cls");
+    #else
+        system("clear");
+    #endif
+}
+
+void continueLoad() {
+    cout << "Press any key to continue...";
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    cin.get();
+}
+
+// Function to find patient index by ID through the store's hash index
+// Returns the row of the patient in the store (0..size-1), or -1 if not found
+// With a sharded data file only the ID's shard is consulted, and loaded
+// first if it is not in memory, and with --lazy the record is read from
+// the data file first; the caller then holds the store lock exclusively
+// (readers call prepareShardOf() and lookupPatient() instead).
+int findPatientIndexByID(int id) {
+    loadPatientOf(id);
+    return patients.find(id);
+}
+
+// LSD radix sort of rows by patient ID, 8 bits per pass. Passes where every
+// key has the same byte (typically the high bytes of registration IDs) are
+// skipped.
+void radixSortRowsByID(vector<int>& rows) {
+    size_t n = rows.size();
+    vector<uint32_t> keys(n), keysTmp(n);
+    vector<int> rowsTmp(n);
+    for (size_t i = 0; i < n; ++i) {
+        // Flip the sign bit so negative IDs order before positive ones
+        keys[i] = (uint32_t)patients.id[rows[i]] ^ 0x80000000u;
+    }
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < n; ++i) counts[(keys[i] >> shift) & 0xFF]++;
+        if (n == 0 || counts[(keys[0] >> shift) & 0xFF] == n) continue;
+
+        size_t offset = 0;
+        for (size_t& c : counts) {
+            size_t next = offset + c;
+            c = offset;
+            offset = next;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            size_t dst = counts[(keys[i] >> shift) & 0xFF]++;
+            keysTmp[dst] = keys[i];
+            rowsTmp[dst] = rows[i];
+        }
+        keys.swap(keysTmp);
+        rows.swap(rowsTmp);
+    }
+}
+
+// First 8 bytes of a name packed big-endian, so comparing two prefixes as
+// integers orders them the same way as comparing the strings
+uint64_t namePrefixKey(string_view name) {
+    uint64_t key = 0;
+    size_t len = name.size() < 8 ? name.size() : 8;
+    for (size_t i = 0; i < 8; ++i) {
+        key <<= 8;
+        if (i < len) key |= (unsigned char)name[i];
+    }
+    return key;
+}
+
+// Every live row of the store, in row order
+void liveRows(vector<int>& rows) {
+    rows.clear();
+    rows.reserve(patients.size());
+    for (int i = 0; i < patients.rows(); ++i) {
+        if (patients.isLive(i)) rows.push_back(i);
+    }
+}
+
+// Rows named since the last merge that make prefix search merge them into
+// the sorted entries; the trigram lists are rebuilt once they hold this many
+// times 16 stale entries
+const size_t NAME_INDEX_MERGE_ROWS = 4096;
+
+// Compare two names ignoring ASCII case
+int compareNamesIgnoreCase(string_view a, string_view b) {
+    size_t n = min(a.size(), b.size());
+    for (size_t i = 0; i < n; ++i) {
+        int x = tolower((unsigned char)a[i]), y = tolower((unsigned char)b[i]);
+        if (x != y) return x < y ? -1 : 1;
+    }
+    return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+// Name index entry for a name; lower is the name in lower case, or at
+// least its first 16 bytes
+NameIndex::Entry nameEntry(string_view name, string_view lower, int patientId, int row) {
+    string_view next = lower.size() > 8 ? lower.substr(8) : string_view();
+    return NameIndex::Entry{namePrefixKey(lower), namePrefixKey(next), name, patientId, row};
+}
+
+// Name index entry of a live row
+NameIndex::Entry nameEntry(int row) {
+    string_view name = patients.name[row];
+    return nameEntry(name, lowerName(name.substr(0, 16)), patients.id[row], row);
+}
+
+// Does the entry still describe its row?
+bool isCurrentNameEntry(const NameIndex::Entry& e) {
+    return patients.isLive(e.row) && patients.id[e.row] == e.id && patients.name[e.row] == e.name;
+}
+
+// Name order of entries, ignoring case, then ID. Only the entries' own
+// fields are compared, so stale entries keep their place. Returns <0, 0
+// or >0 like strcmp.
+int compareNameEntries(const NameIndex::Entry& a, const NameIndex::Entry& b) {
+    if (a.key != b.key) return a.key < b.key ? -1 : 1;
+    if (a.next != b.next) return a.next < b.next ? -1 : 1;
+    if (a.name.size() > 16 || b.name.size() > 16) {
+        int cmp = compareNamesIgnoreCase(a.name.substr(min(a.name.size(), (size_t)16)),
+                                         b.name.substr(min(b.name.size(), (size_t)16)));
+        if (cmp != 0) return cmp;
+    }
+    return a.id != b.id ? (a.id < b.id ? -1 : 1) : 0;
+}
+
+bool nameEntryLess(const NameIndex::Entry& a, const NameIndex::Entry& b) {
+    return compareNameEntries(a, b) < 0;
+}
+
+// Build the name index over the live rows
+void buildNameIndex() {
+    NameIndex& names = patients.names;
+    names.clear();
+    names.sorted.reserve(patients.size());
+    for (int i = 0; i < patients.rows(); ++i) {
+        if (!patients.isLive(i)) continue;
+        string lower = lowerName(patients.name[i]);
+        names.sorted.push_back(nameEntry(patients.name[i], lower, patients.id[i], i));
+        names.addTrigrams(i, lower);
+    }
+    sort(names.sorted.begin(), names.sorted.end(), nameEntryLess);
+    names.trigramEntriesAtBuild = names.trigramEntries;
+    names.built = true;
+}
+
+// Drop the entries of deleted or renamed rows and merge the recently
+// named rows into the sorted entries
+void mergeRecentNames() {
+    NameIndex& names = patients.names;
+    auto stale = [](const NameIndex::Entry& e) { return !isCurrentNameEntry(e); };
+    names.sorted.erase(remove_if(names.sorted.begin(), names.sorted.end(), stale), names.sorted.end());
+
+    // A row named twice since the last merge is in recent twice, and a row
+    // renamed back to its old name still has its entry
+    sort(names.recent.begin(), names.recent.end());
+    names.recent.erase(unique(names.recent.begin(), names.recent.end()), names.recent.end());
+    vector<NameIndex::Entry> fresh;
+    for (int row : names.recent) {
+        if (!patients.isLive(row)) continue;
+        NameIndex::Entry e = nameEntry(row);
+        if (!binary_search(names.sorted.begin(), names.sorted.end(), e, nameEntryLess)) fresh.push_back(e);
+    }
+    sort(fresh.begin(), fresh.end(), nameEntryLess);
+
+    vector<NameIndex::Entry> merged(names.sorted.size() + fresh.size());
+    merge(names.sorted.begin(), names.sorted.end(), fresh.begin(), fresh.end(), merged.begin(), nameEntryLess);
+    names.sorted.swap(merged);
+    names.recent.clear();
+}
+
+// Build the name index, or bring it up to date, before a search
+void prepareNameIndex() {
+    NameIndex& names = patients.names;
+    if (!names.built || names.trigramEntries > 2 * names.trigramEntriesAtBuild + 16 * NAME_INDEX_MERGE_ROWS) {
+        buildNameIndex();
+    } else if (names.recent.size() >= NAME_INDEX_MERGE_ROWS) {
+        mergeRecentNames();
+    }
+}
+
+// Does name start with lowerPrefix, ignoring ASCII case?
+bool startsWithIgnoreCase(string_view name, const string& lowerPrefix) {
+    if (name.size() < lowerPrefix.size()) return false;
+    for (size_t i = 0; i < lowerPrefix.size(); ++i) {
+        if (tolower((unsigned char)name[i]) != (unsigned char)lowerPrefix[i]) return false;
+    }
+    return true;
+}
+
+// Rows of up to limit patients whose name starts with prefix, ignoring
+// case, in name order. Binary search finds the first candidate, so the
+// cost is O(log n + limit) plus the rows named since the last merge.
+// Callers on other threads than the menu must hold storeMutex.
+vector<int> searchNamesByPrefix(string_view prefix, size_t limit) {
+    NameIndex& names = patients.names;
+    lock_guard<mutex> guard(names.lock);
+    prepareNameIndex();
+
+    // The names starting with the prefix follow the first entry that
+    // does not sort before it. Stale entries are skipped: a renamed row is
+    // in recent.
+    string lowerPrefix = lowerName(prefix);
+    NameIndex::Entry first = nameEntry(lowerPrefix, lowerPrefix, INT_MIN, -1);
+    vector<int> rows;
+    auto it = lower_bound(names.sorted.begin(), names.sorted.end(), first, nameEntryLess);
+    for (; it != names.sorted.end() && rows.size() < limit && startsWithIgnoreCase(it->name, lowerPrefix); ++it) {
+        if (isCurrentNameEntry(*it)) rows.push_back(it->row);
+    }
+    for (int row : names.recent) {
+        if (patients.isLive(row) && startsWithIgnoreCase(patients.name[row], lowerPrefix)) rows.push_back(row);
+    }
+
+    auto byName = [](int a, int b) {
+        int cmp = compareNamesIgnoreCase(patients.name[a], patients.name[b]);
+        return cmp != 0 ? cmp < 0 : patients.id[a] < patients.id[b];
+    };
+    sort(rows.begin(), rows.end());
+    rows.erase(unique(rows.begin(), rows.end()), rows.end());
+    size_t found = min(rows.size(), limit);
+    partial_sort(rows.begin(), rows.begin() + found, rows.end(), byName);
+    rows.resize(found);
+    return rows;
+}
+
+// Levenshtein distance between two strings
+int editDistance(string_view a, string_view b) {
+    vector<int> previous(b.size() + 1), current(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j) previous[j] = (int)j;
+    for (size_t i = 1; i <= a.size(); ++i) {
+        current[0] = (int)i;
+        for (size_t j = 1; j <= b.size(); ++j) {
+            int substitute = previous[j - 1] + (a[i - 1] != b[j - 1]);
+            current[j] = min(min(previous[j] + 1, current[j - 1] + 1), substitute);
+        }
+        previous.swap(current);
+    }
+    return previous[b.size()];
+}
+
+// A fuzzy name search result
+struct NameMatch {
+    int row;
+    int shared;   // trigrams the name shares with the query
+    int distance; // edit distance between query and name, ignoring case
+};
+
+// Up to limit patients whose names are most similar to query: most shared
+// trigrams first, then smallest edit distance, then lowest ID. The trigram
+// lists give a shared count per row; only the best candidates are then
+// checked against their current name. Callers on other threads than the
+// menu must hold storeMutex.
+vector<NameMatch> searchNamesFuzzy(string_view query, size_t limit) {
+    NameIndex& names = patients.names;
+    lock_guard<mutex> guard(names.lock);
+    prepareNameIndex();
+
+    string lower = lowerName(query);
+    vector<uint32_t> grams = nameTrigrams(lower);
+    names.counts.resize(patients.rows(), 0);
+    vector<int> touched;
+    for (uint32_t gram : grams) {
+        auto list = names.trigrams.find(gram);
+        if (list == names.trigrams.end()) continue;
+        for (int row : list->second) {
+            if (names.counts[row]++ == 0) touched.push_back(row);
+        }
+    }
+
+    size_t candidates = min(touched.size(), max(limit * 8, (size_t)256));
+    nth_element(touched.begin(), touched.begin() + candidates, touched.end(),
+                [&names](int a, int b) { return names.counts[a] > names.counts[b]; });
+    for (int row : touched) names.counts[row] = 0;
+    touched.resize(candidates);
+    sort(touched.begin(), touched.end());
+    touched.erase(unique(touched.begin(), touched.end()), touched.end());
+
+    vector<NameMatch> matches;
+    for (int row : touched) {
+        if (!patients.isLive(row)) continue;
+        string name = lowerName(patients.name[row]);
+        vector<uint32_t> nameGrams = nameTrigrams(name);
+        vector<uint32_t> common;
+        set_intersection(grams.begin(), grams.end(), nameGrams.begin(), nameGrams.end(), back_inserter(common));
+        if (common.empty()) continue;
+        matches.push_back(NameMatch{row, (int)common.size(), editDistance(lower, name)});
+    }
+    sort(matches.begin(), matches.end(), [](const NameMatch& a, const NameMatch& b) {
+        if (a.shared != b.shared) return a.shared > b.shared;
+        if (a.distance != b.distance) return a.distance < b.distance;
+        return patients.id[a.row] < patients.id[b.row];
+    });
+    if (matches.size() > limit) matches.resize(limit);
+    return matches;
+}
+
+// Patients per page of "Display All Patients"
+const size_t LISTING_PAGE_SIZE = 20;
+
+// Position in a listing of all patients by ID, by name or by age, just
+// past the last patient returned. A new cursor starts at the first patient.
+struct ListCursor {
+    bool byName = false;
+    bool byAge = false;
+    bool ascending = true;
+    bool started = false;
+    int id = 0;  // last patient returned
+    string name;
+    int age = 0;
+};
+
+// Bring the ID order up to date before a listing
+void prepareIdOrder() {
+    IdOrder& order = patients.idOrder;
+    if (!order.built) {
+        vector<int> rows;
+        liveRows(rows);
+        radixSortRowsByID(rows);
+        order.sorted.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i) order.sorted[i] = patients.id[rows[i]];
+        order.built = true;
+    } else if (order.recent.size() >= NAME_INDEX_MERGE_ROWS) {
+        auto deleted = [](int patientId) { return patients.find(patientId) == -1; };
+        order.sorted.erase(remove_if(order.sorted.begin(), order.sorted.end(), deleted), order.sorted.end());
+        sort(order.recent.begin(), order.recent.end());
+        size_t middle = order.sorted.size();
+        order.sorted.insert(order.sorted.end(), order.recent.begin(), order.recent.end());
+        inplace_merge(order.sorted.begin(), order.sorted.begin() + middle, order.sorted.end());
+        order.sorted.erase(unique(order.sorted.begin(), order.sorted.end()), order.sorted.end());
+        order.recent.clear();
+    }
+}
+
+// IDs of up to limit patients past the cursor, in listing order
+vector<int> nextIdsById(const ListCursor& cursor, size_t limit) {
+    IdOrder& order = patients.idOrder;
+    vector<int> ids;
+    if (cursor.ascending) {
+        auto it = cursor.started ? upper_bound(order.sorted.begin(), order.sorted.end(), cursor.id) : order.sorted.begin();
+        for (; it != order.sorted.end() && ids.size() < limit; ++it) {
+            if (patients.find(*it) != -1) ids.push_back(*it);
+        }
+    } else {
+        auto it = cursor.started ? lower_bound(order.sorted.begin(), order.sorted.end(), cursor.id) : order.sorted.end();
+        while (it != order.sorted.begin() && ids.size() < limit) {
+            --it;
+            if (patients.find(*it) != -1) ids.push_back(*it);
+        }
+    }
+    for (int patientId : order.recent) {
+        bool past = !cursor.started || (cursor.ascending ? patientId > cursor.id : patientId < cursor.id);
+        if (past && patients.find(patientId) != -1) ids.push_back(patientId);
+    }
+    if (cursor.ascending) {
+        sort(ids.begin(), ids.end());
+    } else {
+        sort(ids.begin(), ids.end(), greater<int>());
+    }
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    if (ids.size() > limit) ids.resize(limit);
+    return ids;
+}
+
+// Whether an AgeOrder entry still holds for its patient
+bool isCurrentAgeEntry(uint64_t key) {
+    int row = patients.find(idOfKey(key));
+    return row != -1 && patients.age[row] == ageOfKey(key);
+}
+
+// Bring the age order up to date before a listing or an age range
+void prepareAgeOrder() {
+    AgeOrder& order = patients.ageOrder;
+    if (!order.built) {
+        order.sorted.clear();
+        order.sorted.reserve(patients.size());
+        for (int i = 0; i < patients.rows(); ++i) {
+            if (patients.isLive(i)) order.sorted.push_back(ageOrderKey(patients.age[i], patients.id[i]));
+        }
+        sort(order.sorted.begin(), order.sorted.end());
+        order.built = true;
+    } else if (order.recent.size() >= NAME_INDEX_MERGE_ROWS) {
+        auto stale = [](uint64_t key) { return !isCurrentAgeEntry(key); };
+        order.sorted.erase(remove_if(order.sorted.begin(), order.sorted.end(), stale), order.sorted.end());
+        sort(order.recent.begin(), order.recent.end());
+        size_t middle = order.sorted.size();
+        order.sorted.insert(order.sorted.end(), order.recent.begin(), order.recent.end());
+        inplace_merge(order.sorted.begin(), order.sorted.begin() + middle, order.sorted.end());
+        order.sorted.erase(unique(order.sorted.begin(), order.sorted.end()), order.sorted.end());
+        order.recent.clear();
+    }
+}
+
+// IDs of up to limit patients past the cursor, in listing order by age
+vector<int> nextIdsByAge(const ListCursor& cursor, size_t limit) {
+    AgeOrder& order = patients.ageOrder;
+    uint64_t at = ageOrderKey(cursor.age, cursor.id);
+    vector<uint64_t> keys;
+    if (cursor.ascending) {
+        auto it = cursor.started ? upper_bound(order.sorted.begin(), order.sorted.end(), at) : order.sorted.begin();
+        for (; it != order.sorted.end() && keys.size() < limit; ++it) {
+            if (isCurrentAgeEntry(*it)) keys.push_back(*it);
+        }
+    } else {
+        auto it = cursor.started ? lower_bound(order.sorted.begin(), order.sorted.end(), at) : order.sorted.end();
+        while (it != order.sorted.begin() && keys.size() < limit) {
+            --it;
+            if (isCurrentAgeEntry(*it)) keys.push_back(*it);
+        }
+    }
+    for (uint64_t key : order.recent) {
+        bool past = !cursor.started || (cursor.ascending ? key > at : key < at);
+        if (past && isCurrentAgeEntry(key)) keys.push_back(key);
+    }
+    if (cursor.ascending) {
+        sort(keys.begin(), keys.end());
+    } else {
+        sort(keys.begin(), keys.end(), greater<uint64_t>());
+    }
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    if (keys.size() > limit) keys.resize(limit);
+    vector<int> ids;
+    for (uint64_t key : keys) ids.push_back(idOfKey(key));
+    return ids;
+}
+
+// Rows of up to limit patients past the cursor, in listing order by name
+vector<int> nextRowsByName(const ListCursor& cursor, size_t limit) {
+    NameIndex& names = patients.names;
+    NameIndex::Entry at = nameEntry(cursor.name, lowerName(string_view(cursor.name).substr(0, 16)), cursor.id, -1);
+
+    // Binary search for the cursor, then walk away from it. Stale entries
+    // are skipped: a renamed row is in recent.
+    vector<int> rows;
+    if (cursor.ascending) {
+        auto it = names.sorted.begin();
+        if (cursor.started) it = upper_bound(names.sorted.begin(), names.sorted.end(), at, nameEntryLess);
+        for (; it != names.sorted.end() && rows.size() < limit; ++it) {
+            if (isCurrentNameEntry(*it)) rows.push_back(it->row);
+        }
+    } else {
+        auto it = names.sorted.end();
+        if (cursor.started) it = lower_bound(names.sorted.begin(), names.sorted.end(), at, nameEntryLess);
+        while (it != names.sorted.begin() && rows.size() < limit) {
+            --it;
+            if (isCurrentNameEntry(*it)) rows.push_back(it->row);
+        }
+    }
+    for (int row : names.recent) {
+        if (!patients.isLive(row)) continue;
+        int cmp = cursor.started ? compareNameEntries(nameEntry(row), at) : 0;
+        if (!cursor.started || (cursor.ascending ? cmp > 0 : cmp < 0)) rows.push_back(row);
+    }
+
+    auto inListingOrder = [&cursor](int a, int b) {
+        int cmp = compareNamesIgnoreCase(patients.name[a], patients.name[b]);
+        if (cmp == 0) cmp = patients.id[a] < patients.id[b] ? -1 : (patients.id[a] > patients.id[b] ? 1 : 0);
+        return cursor.ascending ? cmp < 0 : cmp > 0;
+    };
+    sort(rows.begin(), rows.end());
+    rows.erase(unique(rows.begin(), rows.end()), rows.end());
+    size_t page = min(rows.size(), limit);
+    partial_sort(rows.begin(), rows.begin() + page, rows.end(), inListingOrder);
+    rows.resize(page);
+    return rows;
+}
+
+// Fill rows with the next page of up to pageSize patients after the cursor
+// and move the cursor past them. Returns whether more patients follow.
+// Only the page is looked at: a page costs O(log n + pageSize) plus the
+// patients added or renamed since the listing order was last merged.
+// Callers on other threads than the menu must hold storeMutex.
+bool nextPatientPage(ListCursor& cursor, size_t pageSize, vector<int>& rows) {
+    rows.clear();
+    if (cursor.byName) {
+        lock_guard<mutex> guard(patients.names.lock);
+        prepareNameIndex();
+        rows = nextRowsByName(cursor, pageSize + 1);
+    } else if (cursor.byAge) {
+        lock_guard<mutex> guard(patients.ageOrder.lock);
+        prepareAgeOrder();
+        for (int patientId : nextIdsByAge(cursor, pageSize + 1)) rows.push_back(patients.find(patientId));
+    } else {
+        lock_guard<mutex> guard(patients.idOrder.lock);
+        prepareIdOrder();
+        for (int patientId : nextIdsById(cursor, pageSize + 1)) rows.push_back(patients.find(patientId));
+    }
+    bool more = rows.size() > pageSize;
+    if (more) rows.resize(pageSize);
+    if (!rows.empty()) {
+        cursor.started = true;
+        cursor.id = patients.id[rows.back()];
+        cursor.name = string(patients.name[rows.back()]);
+        cursor.age = patients.age[rows.back()];
+    }
+    return more;
+}
+
+// IDs of the patients with an ID from `from` to `to`, ascending. A binary
+// search in the ID order finds the start of the range, so this costs
+// O(log n + k) plus the IDs added since the order was last merged. Callers
+// on other threads than the menu must hold storeMutex.
+vector<int> patientIdsInRange(int from, int to) {
+    IdOrder& order = patients.idOrder;
+    lock_guard<mutex> guard(order.lock);
+    prepareIdOrder();
+    vector<int> ids;
+    for (auto it = lower_bound(order.sorted.begin(), order.sorted.end(), from);
+         it != order.sorted.end() && *it <= to; ++it) {
+        if (patients.find(*it) != -1) ids.push_back(*it);
+    }
+    size_t middle = ids.size();
+    for (int patientId : order.recent) {
+        if (patientId >= from && patientId <= to && patients.find(patientId) != -1) ids.push_back(patientId);
+    }
+    sort(ids.begin() + middle, ids.end());
+    inplace_merge(ids.begin(), ids.begin() + middle, ids.end());
+    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+// IDs of the patients aged `from` to `to`, by age and then ID, the same way
+// through the age order
+vector<int> patientIdsInAgeRange(int from, int to) {
+    AgeOrder& order = patients.ageOrder;
+    lock_guard<mutex> guard(order.lock);
+    prepareAgeOrder();
+    if (from > to) return vector<int>();
+    uint64_t first = ageOrderKey(from, INT_MIN);
+    uint64_t last = ageOrderKey(to, INT_MAX);
+    vector<uint64_t> keys;
+    for (auto it = lower_bound(order.sorted.begin(), order.sorted.end(), first);
+         it != order.sorted.end() && *it <= last; ++it) {
+        if (isCurrentAgeEntry(*it)) keys.push_back(*it);
+    }
+    size_t middle = keys.size();
+    for (uint64_t key : order.recent) {
+        if (key >= first && key <= last && isCurrentAgeEntry(key)) keys.push_back(key);
+    }
+    sort(keys.begin() + middle, keys.end());
+    inplace_merge(keys.begin(), keys.begin() + middle, keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    vector<int> ids(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) ids[i] = idOfKey(keys[i]);
+    return ids;
+}
+
+// Lowest and highest patient ID and the youngest and oldest age, read off
+// the ends of the ID and age orders. False if there are no patients.
+// Same locking as patientIdsInRange().
+bool patientBounds(int& lowestId, int& highestId, int& youngest, int& oldest) {
+    if (patients.size() == 0) return false;
+    {
+        IdOrder& order = patients.idOrder;
+        lock_guard<mutex> guard(order.lock);
+        prepareIdOrder();
+        auto live = [](int patientId) { return patients.find(patientId) != -1; };
+        auto low = find_if(order.sorted.begin(), order.sorted.end(), live);
+        auto high = find_if(order.sorted.rbegin(), order.sorted.rend(), live);
+        lowestId = low != order.sorted.end() ? *low : INT_MAX;
+        highestId = high != order.sorted.rend() ? *high : INT_MIN;
+        for (int patientId : order.recent) {
+            if (!live(patientId)) continue;
+            lowestId = min(lowestId, patientId);
+            highestId = max(highestId, patientId);
+        }
+    }
+    AgeOrder& order = patients.ageOrder;
+    lock_guard<mutex> guard(order.lock);
+    prepareAgeOrder();
+    auto low = find_if(order.sorted.begin(), order.sorted.end(), isCurrentAgeEntry);
+    auto high = find_if(order.sorted.rbegin(), order.sorted.rend(), isCurrentAgeEntry);
+    youngest = low != order.sorted.end() ? ageOfKey(*low) : INT_MAX;
+    oldest = high != order.sorted.rend() ? ageOfKey(*high) : INT_MIN;
+    for (uint64_t key : order.recent) {
+        if (!isCurrentAgeEntry(key)) continue;
+        youngest = min(youngest, ageOfKey(key));
+        oldest = max(oldest, ageOfKey(key));
+    }
+    return true;
+}
+
+// Group of one row for the given fields; addresses are numbered in the
+// given dictionary
+GroupKey groupKeyOf(const PatientStore& store, int row, const vector<GroupField>& fields, StringInterner& addresses) {
+    GroupKey key = {};
+    for (size_t k = 0; k < fields.size(); ++k) {
+        switch (fields[k]) {
+            case GROUP_AGE: key.part[k] = (uint32_t)ageBracket(store.age[row]); break;
+            case GROUP_GENDER: key.part[k] = store.gender[row]; break;
+            case GROUP_BLOOD: key.part[k] = store.blood[row]; break;
+            case GROUP_DIAGNOSIS: key.part[k] = store.diagnosis[row]; break;
+            case GROUP_ADDRESS: key.part[k] = addresses.intern(store.address[row]); break;
+            default: break;
+        }
+    }
+    return key;
+}
+
+void addToView(AggregateView& view, const PatientStore& store, int row) {
+    uint32_t group = view.groups.group(groupKeyOf(store, row, view.fields, view.addresses));
+    if (group >= view.ages.size()) view.ages.resize(group + 1);
+    view.groups.stats[group].add(store.age[row]);
+    view.ages[group][store.age[row]]++;
+}
+
+void AggregateViews::add(const PatientStore& store, int row) {
+    for (AggregateView& view : views) addToView(view, store, row);
+}
+
+void AggregateViews::remove(const PatientStore& store, int row) {
+    int age = store.age[row];
+    for (AggregateView& view : views) {
+        // A row the view never counted (it is out of date) is left alone
+        long long group = view.groups.find(groupKeyOf(store, row, view.fields, view.addresses));
+        if (group < 0 || (size_t)group >= view.ages.size()) continue;
+        map<int, uint32_t>& ages = view.ages[group];
+        auto it = ages.find(age);
+        if (it == ages.end()) continue;
+        GroupStats& s = view.groups.stats[group];
+        s.count--;
+        s.ageSum -= age;
+        s.histogram[ageBracket(age)]--;
+        if (--it->second == 0) ages.erase(it);
+        s.minAge = ages.empty() ? INT_MAX : ages.begin()->first;
+        s.maxAge = ages.empty() ? INT_MIN : ages.rbegin()->first;
+    }
+}
+
+void AggregateViews::rebuild(const PatientStore& store) {
+    for (AggregateView& view : views) {
+        view.clear();
+        for (int row = 0; row < store.rows(); ++row) {
+            if (store.isLive(row)) addToView(view, store, row);
+        }
+    }
+}
+
+string ageBracketLabel(int bracket) {
+    int from = bracket * AGE_BRACKET_YEARS;
+    if (bracket + 1 == AGE_BRACKETS) return to_string(from) + "+";
+    return to_string(from) + "-" + to_string(from + AGE_BRACKET_YEARS - 1);
+}
+
+string groupLabel(GroupField field, uint32_t code, const StringInterner& addresses) {
+    switch (field) {
+        case GROUP_AGE: return ageBracketLabel((int)code);
+        case GROUP_GENDER: return string(patients.genderDict.get(code));
+        case GROUP_BLOOD: return string(patients.bloodDict.get(code));
+        case GROUP_DIAGNOSIS: return string(patients.diagnosisDict.get(code));
+        case GROUP_ADDRESS: return string(addresses.get(code));
+        default: return string();
+    }
+}
+
+// Read a list of report fields such as "age, gender" (case-insensitive,
+// separated by commas or spaces); false if a name is unknown or repeated
+bool parseGroupFields(string_view text, vector<GroupField>& fields) {
+    fields.clear();
+    string lower = lowerName(text);
+    for (char& c : lower) {
+        if (c == ',') c = ' ';
+    }
+    size_t pos = 0;
+    while ((pos = lower.find_first_not_of(' ', pos)) != string::npos) {
+        size_t end = lower.find(' ', pos);
+        if (end == string::npos) end = lower.size();
+        string_view word = string_view(lower).substr(pos, end - pos);
+        pos = end;
+        int field = 0;
+        while (field < GROUP_FIELD_COUNT && word != GROUP_FIELD_NAMES[field]) field++;
+        if (field == GROUP_FIELD_COUNT || find(fields.begin(), fields.end(), (GroupField)field) != fields.end()) {
+            return false;
+        }
+        fields.push_back((GroupField)field);
+    }
+    return !fields.empty();
+}
+
+// Materialized report over exactly these fields, or null
+const AggregateView* findAggregateView(const vector<GroupField>& fields) {
+    for (const AggregateView& view : patients.aggregates.views) {
+        if (view.fields == fields) return &view;
+    }
+    return nullptr;
+}
+
+// Keep a report over these fields up to date from now on. The caller holds
+// the store lock exclusively.
+void materializeReport(const vector<GroupField>& fields) {
+    if (findAggregateView(fields)) return;
+    patients.aggregates.views.emplace_back();
+    AggregateView& view = patients.aggregates.views.back();
+    view.fields = fields;
+    for (int row = 0; row < patients.rows(); ++row) {
+        if (patients.isLive(row)) addToView(view, patients, row);
+    }
+}
+
+// One group of a finished report
+struct GroupReportRow {
+    vector<string> key; // a label per grouped field
+    GroupStats stats;
+};
+
+// Each thread of a report aggregates at least this many rows
+const int GROUP_MIN_ROWS_PER_THREAD = 1 << 16;
+
+// Groups of one thread's rows
+struct GroupPartial {
+    GroupTable groups;
+    StringInterner addresses;
+};
+
+// Group the patients by the given fields and aggregate every group, under
+// a shared store lock. A materialized report is just read out. Otherwise
+// the rows are cut into one slice per thread and every thread runs a hash
+// aggregation of its slice over the encoded columns into its own table;
+// the tables are then merged into the first. Addresses are not encoded in
+// the store, so every thread numbers them in a dictionary of its own and
+// the merge maps them by text. Groups come out in key order, empty ones
+// left out.
+vector<GroupReportRow> groupPatients(const vector<GroupField>& fields) {
+    const GroupTable* groups;
+    const StringInterner* addresses;
+    vector<GroupPartial> partials;
+
+    const AggregateView* view = findAggregateView(fields);
+    if (view) {
+        groups = &view->groups;
+        addresses = &view->addresses;
+    } else {
+        int rows = patients.rows();
+        int threads = loaderThreads > 0 ? loaderThreads : (int)thread::hardware_concurrency();
+        threads = max(min(threads, rows / GROUP_MIN_ROWS_PER_THREAD), 1);
+        partials.resize(threads);
+        auto aggregate = [&fields, rows, threads](GroupPartial& partial, int t) {
+            int begin = (int)((long long)rows * t / threads);
+            int end = (int)((long long)rows * (t + 1) / threads);
+            for (int row = begin; row < end; ++row) {
+                if (!patients.isLive(row)) continue;
+                GroupKey key = groupKeyOf(patients, row, fields, partial.addresses);
+                partial.groups.stats[partial.groups.group(key)].add(patients.age[row]);
+            }
+        };
+        vector<thread> workers;
+        for (int t = 1; t < threads; ++t) workers.emplace_back(aggregate, std::ref(partials[t]), t);
+        aggregate(partials[0], 0);
+        for (thread& worker : workers) worker.join();
+
+        GroupPartial& merged = partials[0];
+        for (int t = 1; t < threads; ++t) {
+            const GroupPartial& partial = partials[t];
+            for (size_t g = 0; g < partial.groups.size(); ++g) {
+                GroupKey key = partial.groups.keys[g];
+                for (size_t k = 0; k < fields.size(); ++k) {
+                    if (fields[k] == GROUP_ADDRESS) key.part[k] = merged.addresses.intern(partial.addresses.get(key.part[k]));
+                }
+                merged.groups.stats[merged.groups.group(key)].merge(partial.groups.stats[g]);
+            }
+        }
+        groups = &merged.groups;
+        addresses = &merged.addresses;
+    }
+
+    vector<GroupReportRow> report;
+    report.reserve(groups->size());
+    for (size_t g = 0; g < groups->size(); ++g) {
+        if (groups->stats[g].count == 0) continue;
+        GroupReportRow row;
+        for (size_t k = 0; k < fields.size(); ++k) {
+            row.key.push_back(groupLabel(fields[k], groups->keys[g].part[k], *addresses));
+        }
+        row.stats = groups->stats[g];
+        report.push_back(std::move(row));
+    }
+    // Age bracket labels happen to sort in age order as text
+    sort(report.begin(), report.end(),
+         [](const GroupReportRow& a, const GroupReportRow& b) { return a.key < b.key; });
+    return report;
+}
+
+// Index of the lowest set bit of a non-zero mask
+inline int lowestBit(uint64_t mask) {
+#ifdef _MSC_VER
+    unsigned long bit;
+    _BitScanForward64(&bit, mask);
+    return (int)bit;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+// Bitmask of the '|' and '\n' bytes among the 64 bytes starting at p
+inline uint64_t delimiterMask64(const char* p) {
+#ifdef PATIENT_HAVE_SSE2
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    for (int k = 0; k < 4; ++k) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, pipe), _mm_cmpeq_epi8(bytes, newline));
+        mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(hits) << (16 * k);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (int k = 0; k < 64; ++k) {
+        if (p[k] == '|' || p[k] == '\n') mask |= 1ULL << k;
+    }
+    return mask;
+#endif
+}
+
+// Split a buffer in the patients.txt layout into rows without copying it.
+// Delimiters are located 64 bytes at a time and each set bit of the mask is
+// a field or row boundary. onRow receives the nine fields of every
+// non-empty line as views into the buffer; as in the original format, a
+// '|' after the eighth one belongs to the diagnosis.
+template <typename RowFn>
+void scanPatientRows(const char* data, size_t size, RowFn onRow) {
+    string_view fields[9];
+    int fieldIdx = 0;
+    size_t fieldStart = 0;
+
+    auto finishRow = [&](size_t end) {
+        if (end > fieldStart && data[end - 1] == '\r') end--;
+        fields[fieldIdx] = string_view(data + fieldStart, end - fieldStart);
+        bool emptyLine = (fieldIdx == 0 && fields[0].empty());
+        for (int i = fieldIdx + 1; i < 9; ++i) fields[i] = string_view();
+        if (!emptyLine) onRow(fields);
+        fieldIdx = 0;
+    };
+
+    auto handleMask = [&](size_t base, uint64_t mask) {
+        while (mask) {
+            size_t pos = base + lowestBit(mask);
+            mask &= mask - 1;
+            if (data[pos] == '\n') {
+                finishRow(pos);
+                fieldStart = pos + 1;
+            } else if (fieldIdx < 8) {
+                fields[fieldIdx++] = string_view(data + fieldStart, pos - fieldStart);
+                fieldStart = pos + 1;
+            }
+        }
+    };
+
+    size_t base = 0;
+    for (; base + 64 <= size; base += 64) {
+        handleMask(base, delimiterMask64(data + base));
+    }
+    if (base < size) {
+        // Tail shorter than one block: scan a zero-padded copy
+        char tail[64] = {0};
+        memcpy(tail, data + base, size - base);
+        uint64_t mask = delimiterMask64(tail);
+        mask &= (size - base == 64) ? ~0ULL : ((1ULL << (size - base)) - 1);
+        handleMask(base, mask);
+    }
+    if (fieldStart < size || fieldIdx > 0) finishRow(size); // last line without '\n'
+}
+
+// Parse a decimal integer field, allowing leading blanks and a sign
+bool parseIntField(string_view field, int& value) {
+    size_t i = 0;
+    while (i < field.size() && (field[i] == ' ' || field[i] == '\t')) i++;
+    if (i < field.size() && field[i] == '+') i++;
+    const char* first = field.data() + i;
+    const char* last = field.data() + field.size();
+    return from_chars(first, last, value).ec == errc();
+}
+
+// Number of set bits in a mask
+inline int popCount64(uint64_t mask) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(mask);
+#else
+    return __builtin_popcountll(mask);
+#endif
+}
+
+// Conjunctive filter over the hot columns: every constraint must hold. A
+// code of -1 leaves its column unconstrained; age bounds are inclusive.
+struct ScanFilter {
+    int minAge = INT_MIN;
+    int maxAge = INT_MAX;
+    long long gender = -1;
+    long long blood = -1;
+    long long diagnosis = -1;
+};
+
+// Scan kernels evaluate one predicate over 64 consecutive rows and return
+// a bit per row. Each instruction set gets its own implementation of the
+// same two kernels.
+struct ScanKernels {
+    const char* name;
+    uint64_t (*rangeMask)(const int* values, int lo, int hi);
+    uint64_t (*equalMask)(const uint32_t* codes, uint32_t code);
+};
+
+uint64_t rangeMaskScalar(const int* values, int lo, int hi) {
+    uint64_t mask = 0;
+    for (int k = 0; k < 64; ++k) {
+        mask |= (uint64_t)(values[k] >= lo && values[k] <= hi) << k;
+    }
+    return mask;
+}
+
+uint64_t equalMaskScalar(const uint32_t* codes, uint32_t code) {
+    uint64_t mask = 0;
+    for (int k = 0; k < 64; ++k) mask |= (uint64_t)(codes[k] == code) << k;
+    return mask;
+}
+
+#ifdef PATIENT_HAVE_SSE2
+uint64_t rangeMaskSse2(const int* values, int lo, int hi) {
+    const __m128i low = _mm_set1_epi32(lo);
+    const __m128i high = _mm_set1_epi32(hi);
+    uint64_t outside = 0;
+    for (int k = 0; k < 16; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + 4 * k));
+        __m128i out = _mm_or_si128(_mm_cmplt_epi32(v, low), _mm_cmpgt_epi32(v, high));
+        outside |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(out)) << (4 * k);
+    }
+    return ~outside;
+}
+
+uint64_t equalMaskSse2(const uint32_t* codes, uint32_t code) {
+    const __m128i wanted = _mm_set1_epi32((int)code);
+    uint64_t mask = 0;
+    for (int k = 0; k < 16; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(codes + 4 * k));
+        __m128i hits = _mm_cmpeq_epi32(v, wanted);
+        mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(hits)) << (4 * k);
+    }
+    return mask;
+}
+#endif
+
+#ifdef PATIENT_HAVE_AVX2
+__attribute__((target("avx2"))) uint64_t rangeMaskAvx2(const int* values, int lo, int hi) {
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i high = _mm256_set1_epi32(hi);
+    uint64_t outside = 0;
+    for (int k = 0; k < 8; ++k) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + 8 * k));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(low, v), _mm256_cmpgt_epi32(v, high));
+        outside |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(out)) << (8 * k);
+    }
+    return ~outside;
+}
+
+__attribute__((target("avx2"))) uint64_t equalMaskAvx2(const uint32_t* codes, uint32_t code) {
+    const __m256i wanted = _mm256_set1_epi32((int)code);
+    uint64_t mask = 0;
+    for (int k = 0; k < 8; ++k) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(codes + 8 * k));
+        __m256i hits = _mm256_cmpeq_epi32(v, wanted);
+        mask |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hits)) << (8 * k);
+    }
+    return mask;
+}
+#endif
+
+const ScanKernels scalarKernels = {"scalar", rangeMaskScalar, equalMaskScalar};
+#ifdef PATIENT_HAVE_SSE2
+const ScanKernels sse2Kernels = {"sse2", rangeMaskSse2, equalMaskSse2};
+#endif
+#ifdef PATIENT_HAVE_AVX2
+const ScanKernels avx2Kernels = {"avx2", rangeMaskAvx2, equalMaskAvx2};
+#endif
+
+// Every kernel set this CPU can run, best last
+vector<const ScanKernels*> availableScanKernels() {
+    vector<const ScanKernels*> kernels = {&scalarKernels};
+#ifdef PATIENT_HAVE_SSE2
+    kernels.push_back(&sse2Kernels);
+#endif
+#ifdef PATIENT_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) kernels.push_back(&avx2Kernels);
+#endif
+    return kernels;
+}
+
+const ScanKernels& bestScanKernels() {
+    static const ScanKernels* best = availableScanKernels().back();
+    return *best;
+}
+
+// Evaluate filter over every row of the store. If selection is given it
+// receives one bit per row (bit i % 64 of word i / 64). Returns the number
+// of matching rows. Blocks of 64 rows are checked one predicate at a time,
+// starting from the block's live bits, and a block stops as soon as none
+// of its rows is left.
+long long scanPatients(const ScanFilter& filter, vector<uint64_t>* selection,
+                       const ScanKernels& kernels = bestScanKernels()) {
+    size_t n = patients.id.size();
+    size_t blocks = (n + 63) / 64;
+    if (selection) selection->assign(blocks, 0);
+    bool byAge = filter.minAge != INT_MIN || filter.maxAge != INT_MAX;
+
+    auto evaluate = [&](uint64_t mask, const int* age, const uint32_t* gender, const uint32_t* blood,
+                        const uint32_t* diagnosis) {
+        if (byAge) mask &= kernels.rangeMask(age, filter.minAge, filter.maxAge);
+        if (mask && filter.gender >= 0) mask &= kernels.equalMask(gender, (uint32_t)filter.gender);
+        if (mask && filter.blood >= 0) mask &= kernels.equalMask(blood, (uint32_t)filter.blood);
+        if (mask && filter.diagnosis >= 0) mask &= kernels.equalMask(diagnosis, (uint32_t)filter.diagnosis);
+        return mask;
+    };
+
+    long long count = 0;
+    size_t full = n / 64;
+    for (size_t b = 0; b < full; ++b) {
+        size_t row = b * 64;
+        uint64_t mask = evaluate(patients.live[b], patients.age.data() + row, patients.gender.data() + row,
+                                 patients.blood.data() + row, patients.diagnosis.data() + row);
+        count += popCount64(mask);
+        if (selection) (*selection)[b] = mask;
+    }
+    if (full < blocks) {
+        // Last partial block: evaluate a padded copy and cut off the padding
+        size_t row = full * 64;
+        size_t rest = n - row;
+        int age[64] = {0};
+        uint32_t gender[64] = {0}, blood[64] = {0}, diagnosis[64] = {0};
+        memcpy(age, patients.age.data() + row, rest * sizeof(int));
+        memcpy(gender, patients.gender.data() + row, rest * sizeof(uint32_t));
+        memcpy(blood, patients.blood.data() + row, rest * sizeof(uint32_t));
+        memcpy(diagnosis, patients.diagnosis.data() + row, rest * sizeof(uint32_t));
+        uint64_t mask = evaluate(patients.live[full] & ((1ULL << rest) - 1), age, gender, blood, diagnosis);
+        count += popCount64(mask);
+        if (selection) (*selection)[full] = mask;
+    }
+    return count;
+}
+
+// Call onRow with every row whose bit is set in selection, in row order
+template <typename RowFn>
+void forEachSelected(const vector<uint64_t>& selection, RowFn onRow) {
+    for (size_t b = 0; b < selection.size(); ++b) {
+        uint64_t mask = selection[b];
+        while (mask) {
+            onRow((int)(b * 64 + lowestBit(mask)));
+            mask &= mask - 1;
+        }
+    }
+}
+
+// Text data files are checked in blocks: after every TEXT_BLOCK_ROWS rows
+// comes a trailer line "#|<rows>|<checksum>" holding the number of rows
+// since the previous trailer and hashBytes() of their bytes as 16 hex
+// digits. The '#' keeps older versions from taking a trailer for a
+// patient. Files without trailers (older saves, hand-written files) load
+// unchecked.
+const int TEXT_BLOCK_ROWS = 256;
+
+// Append the trailer of the block of `rows` rows that starts at
+// out[blockStart]
+void appendBlockTrailer(string& out, size_t blockStart, int rows) {
+    char line[48];
+    snprintf(line, sizeof line, "#|%d|%016llx\n", rows,
+             (unsigned long long)hashBytes(out.data() + blockStart, out.size() - blockStart));
+    out += line;
+}
+
+// Start of the line after the next block trailer at or after p, or null
+const char* findBlockEnd(const char* p, const char* end) {
+    const char* from = p;
+    while (p < end) {
+        const char* hash = (const char*)memchr(p, '#', end - p);
+        if (!hash) return nullptr;
+        p = hash + 1;
+        if (p < end && *p == '|' && hash > from && hash[-1] == '\n') {
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            return newline ? newline + 1 : end;
+        }
+    }
+    return nullptr;
+}
+
+// True if a text file has block trailers. A checked file has its first
+// trailer within TEXT_BLOCK_ROWS rows, so only the start is looked at; the
+// end may be torn.
+bool hasBlockTrailers(const char* data, size_t size) {
+    return findBlockEnd(data, data + min(size, (size_t)1 << 20)) != nullptr;
+}
+
+// Block trailers met while one range of a text file is parsed. A trailer
+// closes the current block: if its row count or checksum does not match,
+// the rows parsed from the block are taken back and its bytes are kept for
+// the quarantine file. The block is hashed right after it was parsed, while
+// it is still in cache, so checking costs no second pass over the file.
+struct BlockChecker {
+    const char* blockStart = nullptr;
+    const char* end = nullptr;
+    size_t blockFirstRow = 0; // rows kept before the current block
+    bool sawTrailer = false;
+    vector<string_view> damaged; // bytes of the blocks taken back
+    size_t damagedRows = 0;
+
+    void start(const char* begin, const char* rangeEnd) {
+        blockStart = begin;
+        end = rangeEnd;
+    }
+
+    // Close the block at the trailer row `fields`, with `rows` rows parsed
+    // so far, and return how many of them to keep
+    size_t close(const string_view* fields, size_t rows) {
+        sawTrailer = true;
+        const char* trailer = fields[0].data();
+        string_view block(blockStart, trailer - blockStart);
+        size_t blockRows = rows - blockFirstRow;
+        int expected;
+        uint64_t checksum = 0;
+        const char* hex = fields[2].data();
+        bool ok = hex && parseIntField(fields[1], expected) && (size_t)expected == blockRows &&
+                  from_chars(hex, hex + fields[2].size(), checksum, 16).ptr == hex + fields[2].size() &&
+                  checksum == hashBytes(block.data(), block.size());
+        if (!ok) {
+            damaged.push_back(block);
+            damagedRows += blockRows;
+            rows = blockFirstRow;
+        }
+
+        // The next block starts after the trailer line
+        int last = 8;
+        while (last > 0 && !fields[last].data()) last--;
+        const char* next = fields[last].data() + fields[last].size();
+        if (next < end && *next == '\r') next++;
+        if (next < end && *next == '\n') next++;
+        blockStart = next;
+        blockFirstRow = rows;
+        return rows;
+    }
+
+    // End of the range with `rows` rows parsed. In a checked file, rows
+    // after the last trailer are unverified and are taken back too.
+    size_t finish(size_t rows, bool checked) {
+        string_view tail(blockStart, end - blockStart);
+        if (!checked || tail.find_first_not_of("\r\n") == string_view::npos) return rows;
+        damaged.push_back(tail);
+        damagedRows += rows - blockFirstRow;
+        return blockFirstRow;
+    }
+};
+
+// Rows parsed by one loader thread from its chunk of the file. Codes refer
+// to the chunk's own dictionaries until the chunks are merged. Columns are
+// in binary snapshot order (see snapshotTextColumn/snapshotCodeColumn).
+struct LoadChunk {
+    const char* begin = nullptr;
+    size_t size = 0;
+    vector<int> id;
+    vector<int> age;
+    vector<string_view> text[BINARY_TEXT_COLUMNS];
+    vector<uint32_t> codes[BINARY_CODE_COLUMNS];
+    StringInterner dictionaries[BINARY_CODE_COLUMNS];
+    bool checked = false; // the file has block trailers
+    BlockChecker check;
+
+    void truncate(size_t rows) {
+        id.resize(rows);
+        age.resize(rows);
+        for (auto& column : text) column.resize(rows);
+        for (auto& column : codes) column.resize(rows);
+    }
+};
+
+// File fields of the text and code columns, in binary snapshot order
+const int LOAD_TEXT_FIELDS[BINARY_TEXT_COLUMNS] = {1, 5, 6, 7};
+const int LOAD_CODE_FIELDS[BINARY_CODE_COLUMNS] = {3, 4, 8};
+
+// Each parser thread gets at least this much of the file
+const size_t LOADER_MIN_CHUNK_BYTES = 4 << 20;
+
+// Number of parser threads for a text file of the given size
+int loadThreadCount(size_t bytes) {
+    int threads = loaderThreads > 0 ? loaderThreads : (int)thread::hardware_concurrency();
+    size_t chunks = bytes / LOADER_MIN_CHUNK_BYTES + 1;
+    if ((size_t)threads > chunks) threads = (int)chunks;
+    return max(threads, 1);
+}
+
+// Parse one chunk into its columns, checking its blocks on the way
+void parseLoadChunk(LoadChunk& chunk) {
+    // Size the columns from the average line length of the first 64 KB
+    size_t sample = min(chunk.size, (size_t)65536);
+    size_t sampleLines = count(chunk.begin, chunk.begin + sample, '\n');
+    size_t expected = sampleLines > 0 ? chunk.size / (sample / sampleLines) + 16 : 16;
+    chunk.id.reserve(expected);
+    chunk.age.reserve(expected);
+    for (auto& column : chunk.text) column.reserve(expected);
+    for (auto& column : chunk.codes) column.reserve(expected);
+
+    chunk.check.start(chunk.begin, chunk.begin + chunk.size);
+    scanPatientRows(chunk.begin, chunk.size, [&chunk](const string_view* fields) {
+        if (fields[0] == "#") {
+            chunk.truncate(chunk.check.close(fields, chunk.id.size()));
+            return;
+        }
+        int id, age;
+        if (!parseIntField(fields[0], id) || !parseIntField(fields[2], age)) return;
+        chunk.id.push_back(id);
+        chunk.age.push_back(age);
+        for (int k = 0; k < BINARY_TEXT_COLUMNS; ++k) chunk.text[k].push_back(fields[LOAD_TEXT_FIELDS[k]]);
+        for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+            chunk.codes[k].push_back(chunk.dictionaries[k].intern(fields[LOAD_CODE_FIELDS[k]]));
+        }
+    });
+    chunk.truncate(chunk.check.finish(chunk.id.size(), chunk.checked));
+}
+
+// Append the rows of parsed chunks to the store in chunk order. Their
+// dictionaries are interned into the store's (so codes come out as in a
+// sequential load) and every thread copies one chunk's rows into its own
+// slice of the store columns, translating codes on the way. The new rows
+// are neither marked live nor indexed.
+void mergeLoadChunks(vector<LoadChunk>& chunks) {
+    int count = (int)chunks.size();
+
+    // Chunk code -> store code, and where each chunk's rows start
+    vector<vector<uint32_t>> remap(count * BINARY_CODE_COLUMNS);
+    vector<size_t> firstRow(count + 1, (size_t)patients.rows());
+    for (int t = 0; t < count; ++t) {
+        for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+            const StringInterner& local = chunks[t].dictionaries[k];
+            vector<uint32_t>& codes = remap[t * BINARY_CODE_COLUMNS + k];
+            codes.resize(local.size());
+            for (uint32_t code = 0; code < local.size(); ++code) {
+                codes[code] = snapshotDictionary(k)->intern(local.get(code));
+            }
+        }
+        firstRow[t + 1] = firstRow[t] + chunks[t].id.size();
+    }
+
+    size_t rows = firstRow[count];
+    patients.id.resize(rows);
+    patients.age.resize(rows);
+    for (int k = 0; k < BINARY_TEXT_COLUMNS; ++k) snapshotTextColumn(k)->resize(rows);
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) snapshotCodeColumn(k)->resize(rows);
+
+    auto merge = [&](int t) {
+        LoadChunk& chunk = chunks[t];
+        size_t first = firstRow[t];
+        size_t n = chunk.id.size();
+        copy(chunk.id.begin(), chunk.id.end(), patients.id.begin() + first);
+        copy(chunk.age.begin(), chunk.age.end(), patients.age.begin() + first);
+        for (int k = 0; k < BINARY_TEXT_COLUMNS; ++k) {
+            copy(chunk.text[k].begin(), chunk.text[k].end(), snapshotTextColumn(k)->begin() + first);
+        }
+        for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+            const vector<uint32_t>& codes = remap[t * BINARY_CODE_COLUMNS + k];
+            uint32_t* out = snapshotCodeColumn(k)->data() + first;
+            for (size_t i = 0; i < n; ++i) out[i] = codes[chunk.codes[k][i]];
+        }
+        // Give the chunk's memory back while the others are still copying
+        chunk = LoadChunk();
+    };
+    vector<thread> workers;
+    for (int t = 1; t < count; ++t) workers.emplace_back(merge, t);
+    if (count > 0) merge(0);
+    for (thread& worker : workers) worker.join();
+    patients.version++;
+}
+
+// Parse the mapped text file in patients.source with several threads.
+// The file is cut into one chunk per thread at line boundaries; each thread
+// parses its chunk into a LoadChunk, and the chunks are then merged in file
+// order. Duplicate IDs, also across chunks, are dropped by the
+// rebuildIndex() that follows. Blocks that fail their check are left out
+// and added to `damaged`.
+void parsePatientsParallel(int threads, vector<string_view>& damaged, size_t& damagedRows) {
+    const char* data = patients.source.data;
+    size_t size = patients.source.size;
+
+    // A checked file is cut after block trailers, so that every block is
+    // checked whole by one thread
+    bool checked = hasBlockTrailers(data, size);
+    vector<LoadChunk> chunks(threads);
+    size_t begin = 0;
+    for (int t = 0; t < threads; ++t) {
+        size_t end = size * (t + 1) / threads;
+        if (t + 1 == threads) {
+            end = size;
+        } else if (end < begin) {
+            end = begin;
+        } else if (checked) {
+            const char* blockEnd = findBlockEnd(data + end, data + size);
+            end = blockEnd ? (size_t)(blockEnd - data) : size;
+        } else {
+            const char* newline = (const char*)memchr(data + end, '\n', size - end);
+            end = newline ? (size_t)(newline - data) + 1 : size;
+        }
+        chunks[t].begin = data + begin;
+        chunks[t].size = end - begin;
+        chunks[t].checked = checked;
+        begin = end;
+    }
+
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(parseLoadChunk, std::ref(chunks[t]));
+    parseLoadChunk(chunks[0]);
+    for (thread& worker : workers) worker.join();
+
+    for (LoadChunk& chunk : chunks) {
+        damaged.insert(damaged.end(), chunk.check.damaged.begin(), chunk.check.damaged.end());
+        damagedRows += chunk.check.damagedRows;
+    }
+    mergeLoadChunks(chunks);
+}
+
+// Load the patients file at path into the store by mapping it and pointing
+// the text columns at the mapped bytes. Both the text layout and the binary
+// snapshot format are accepted. Rows whose ID or age is not a number are
+// skipped. Blocks of a text file that fail their check are left out and
+// moved to "<path>.quarantine"; quarantinedRows tells how many rows they
+// held. Returns the number of rows loaded, -1 if the file could not be
+// opened, or -2 if it is a damaged binary snapshot.
+int loadPatientsFile(const string& path) {
+    StatTimer timer(STAT_LOAD);
+    patients.clear();
+    quarantinedRows = 0;
+    if (!patients.source.open(path)) return -1;
+
+    if (patients.source.size >= sizeof(BinarySnapshotHeader) &&
+        memcmp(patients.source.data, BINARY_SNAPSHOT_MAGIC, sizeof(BINARY_SNAPSHOT_MAGIC)) == 0) {
+        int loaded = loadBinarySnapshot();
+        if (loaded >= 0) countBytesRead(patients.source.size, loaded);
+        return loaded;
+    }
+
+    vector<string_view> damaged;
+    size_t damagedRows = 0;
+    int threads = loadThreadCount(patients.source.size);
+    if (threads > 1) {
+        parsePatientsParallel(threads, damaged, damagedRows);
+    } else {
+        // Size the columns from the average line length of the first 64 KB
+        size_t sample = min(patients.source.size, (size_t)65536);
+        size_t sampleLines = count(patients.source.data, patients.source.data + sample, '\n');
+        if (sampleLines > 0) patients.reserve(patients.source.size / (sample / sampleLines) + 16);
+
+        BlockChecker check;
+        check.start(patients.source.data, patients.source.data + patients.source.size);
+        scanPatientRows(patients.source.data, patients.source.size, [&check](const string_view* fields) {
+            if (fields[0] == "#") {
+                patients.truncateRows((int)check.close(fields, patients.rows()));
+                return;
+            }
+            int id, age;
+            if (!parseIntField(fields[0], id) || !parseIntField(fields[2], age)) return;
+            patients.appendViews(id, age, fields);
+        });
+        patients.truncateRows((int)check.finish(patients.rows(), check.sawTrailer));
+        damaged = std::move(check.damaged);
+        damagedRows = check.damagedRows;
+    }
+    if (!damaged.empty()) {
+        quarantineBlocks(path + ".quarantine", damaged);
+        quarantinedRows = (long long)damagedRows;
+    }
+    // Index all rows in one pass; a repeated ID keeps the first record
+    patients.rebuildIndex();
+    countBytesRead(patients.source.size, patients.size());
+    return patients.size();
+}
+
+void loadFromFile() {
+    clear();
+    cout << "Loading patient data...\n";
+    int sharded = readShardManifest();
+    if (sharded < 0) {
+        cout << "Shard manifest " << shardManifestPath() << " is damaged. Program End\n";
+        exit(1);
+    }
+    if (lazyStartup && (sharded || isBinaryDataPath(dataFilePath))) {
+        // Shards are loaded on demand already, and a binary snapshot is
+        // mapped rather than parsed
+        if (!sharded) cout << "Lazy loading needs a text data file; --lazy is ignored.\n";
+        lazyStartup = false;
+    }
+    if (sharded) {
+        // Shards are loaded when their patients are first needed
+        journal.snapshotBytes = shardBytes();
+    } else if (lazyStartup) {
+        // Records are read from the file when they are first needed
+        long long opened = openLazyPatients(dataFilePath);
+        journal.snapshotBytes = opened < 0 ? 0 : (long long)patients.source.size;
+    } else {
+        // If the file does not exist or failed to open, start with no patients
+        int loaded = loadPatientsFile(dataFilePath);
+        if (loaded == -2) {
+            // Saving over a damaged snapshot would lose it for good
+            cout << "Data file " << dataFilePath << " is damaged (checksum mismatch). Program End\n";
+            exit(1);
+        }
+        journal.snapshotBytes = loaded < 0 ? 0 : (long long)patients.source.size;
+        if (quarantinedRows > 0) {
+            cout << "Warning: " << quarantinedRows << " patient rows in " << dataFilePath
+                 << " failed their checksum and were moved to " << dataFilePath << ".quarantine.\n";
+        }
+    }
+
+    // Changes recorded since the data file was written. A leftover rotated
+    // journal means a compaction did not finish, so fold everything into a
+    // new data file right away.
+    bool interrupted = replayJournalFile(journalOldPath()) >= 0;
+    replayJournalFile(journalPath());
+
+    // "--shards <n>" on a data file that is not sharded yet: split it now.
+    // The old file is kept under another name, since it is no longer read.
+    bool splitting = !sharded && requestedShards > 0;
+    if (splitting && isBinaryDataPath(dataFilePath)) {
+        cout << "Sharded storage needs a text data file; --shards is ignored.\n";
+        splitting = false;
+    }
+    if (splitting) {
+        hydrateAllPatients();
+        splitIntoShards(requestedShards);
+    }
+    if (interrupted || splitting) {
+        long long written;
+        if (writePatientsFile(dataFilePath, written)) {
+            resetJournal(written);
+            if (splitting) {
+                replaceFile(dataFilePath, dataFilePath + ".unsharded");
+                cout << "Split " << dataFilePath << " into " << patients.shards.count() << " shards.\n";
+            }
+        }
+    }
+    if (journal.enabled) openJournal();
+    // Keep the warning about damaged rows on screen
+    if (quarantinedRows == 0) clear();
+}
+
+// Replace the file `to` with `from` in one step, so a reader (or a mapped
+// view of the old file) never sees a half-written file
+bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    remove(to.c_str());
+#endif
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+// Make a file created or renamed in the directory of path durable too
+void syncDirectoryOf(const string& path) {
+#ifndef _WIN32
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : path.substr(0, max(slash, (size_t)1));
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+#endif
+}
+
+// Append the bytes of damaged blocks to the quarantine file at path, each
+// after a comment line, so they can be looked at and repaired by hand
+void quarantineBlocks(const string& path, const vector<string_view>& blocks) {
+    FILE* file = fopen(path.c_str(), "ab");
+    if (!file) return;
+    for (string_view block : blocks) {
+        fprintf(file, "# damaged block, %zu bytes\n", block.size());
+        fwrite(block.data(), 1, block.size(), file);
+        if (!block.empty() && block.back() != '\n') fputc('\n', file);
+    }
+    syncFile(file);
+    fclose(file);
+}
+
+// Flush a stdio stream all the way to the disk
+bool syncFile(FILE* file) {
+    if (fflush(file) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Append one row in the patients.txt layout, newline included
+void appendPatientLine(string& out, int row) {
+    out += to_string(patients.id[row]);
+    out += '|';
+    out += patients.name[row];
+    out += '|';
+    out += to_string(patients.age[row]);
+    out += '|';
+    out += patients.genderOf(row);
+    out += '|';
+    out += patients.bloodOf(row);
+    out += '|';
+    out += patients.phone[row];
+    out += '|';
+    out += patients.cnic[row];
+    out += '|';
+    out += patients.address[row];
+    out += '|';
+    out += patients.diagnosisOf(row);
+    out += '\n';
+}
+
+// Write contents to a temporary file, sync it and rename it over path
+bool writeFileAtomically(const string& path, const string& contents) {
+    string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) return false;
+    bool ok = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    ok = syncFile(file) && ok;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || !replaceFile(tmpPath, path)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    syncDirectoryOf(path);
+    return true;
+}
+
+// Append the live rows from `row` on in the patients.txt layout, with a
+// block trailer after every TEXT_BLOCK_ROWS of them, until `out` has grown
+// to `limit` bytes or the rows run out. Stops only at block ends; `row`
+// is advanced past the rows written.
+void appendTextBlocks(string& out, int& row, size_t limit) {
+    while (row < patients.rows() && out.size() < limit) {
+        size_t blockStart = out.size();
+        int blockRows = 0;
+        for (; row < patients.rows() && blockRows < TEXT_BLOCK_ROWS; ++row) {
+            if (!patients.isLive(row)) continue;
+            appendPatientLine(out, row);
+            blockRows++;
+        }
+        if (blockRows > 0) appendBlockTrailer(out, blockStart, blockRows);
+    }
+}
+
+// Where a text save has got to: the byte of the lazily loaded data file,
+// then the store row
+struct TextCursor {
+    size_t filePos = 0;
+    size_t blockEnd = 0; // end of the file block being copied, checked already
+    int row = 0;
+};
+
+// Append the patients from `cursor` on like appendTextBlocks(). With --lazy
+// the lines of patients that are only in the data file come first, copied
+// as they are into new blocks, then the store's rows. Each block of the
+// data file is checked before its lines are copied (see lazyBlockIntact()),
+// so a damaged one is quarantined rather than saved with a new checksum.
+// Returns false once everything is appended.
+bool appendDataBlocks(string& out, TextCursor& cursor, size_t limit) {
+    const LazyRecords& lazy = patients.lazy;
+    if (lazy.active) {
+        const char* data = patients.source.data;
+        size_t size = patients.source.size;
+        while (cursor.filePos < size && out.size() < limit) {
+            size_t blockStart = out.size();
+            int blockRows = 0;
+            while (cursor.filePos < size && blockRows < TEXT_BLOCK_ROWS) {
+                if (cursor.filePos >= cursor.blockEnd) {
+                    size_t end = lazyBlockEnd(cursor.filePos);
+                    if (!lazyBlockIntact(cursor.filePos, end)) {
+                        cursor.filePos = end;
+                        continue;
+                    }
+                    cursor.blockEnd = end;
+                }
+                size_t pos = cursor.filePos;
+                const char* newline = (const char*)memchr(data + pos, '\n', size - pos);
+                size_t end = newline ? (size_t)(newline - data) : size;
+                cursor.filePos = end + 1;
+                string_view line(data + pos, end - pos);
+                int id;
+                // Skip block trailers, rows a load would skip, and patients
+                // deleted or held by the store; of a repeated ID only the
+                // first line counts
+                if (!parseLineId(line, id) || lazy.deleted.count(id) || patients.find(id) != -1) continue;
+                if (lazy.duplicates && lazy.offsetOf(id) != (long long)pos) continue;
+                if (line.back() == '\r') line.remove_suffix(1);
+                out.append(line.data(), line.size());
+                out += '\n';
+                blockRows++;
+            }
+            if (blockRows > 0) appendBlockTrailer(out, blockStart, blockRows);
+        }
+        if (cursor.filePos < size) return true;
+    }
+    appendTextBlocks(out, cursor.row, limit);
+    return cursor.row < patients.rows();
+}
+
+// Append the listed rows the same way, all of them
+void appendTextBlocks(string& out, const vector<int>& rows) {
+    for (size_t i = 0; i < rows.size(); i += TEXT_BLOCK_ROWS) {
+        size_t blockStart = out.size();
+        size_t end = min(rows.size(), i + TEXT_BLOCK_ROWS);
+        for (size_t j = i; j < end; ++j) appendPatientLine(out, rows[j]);
+        appendBlockTrailer(out, blockStart, (int)(end - i));
+    }
+}
+
+// Write every row to path the same way, in the format its name selects.
+// Text is streamed in pieces of about 1 MB, cut at block ends. The loaded
+// rows may still point into the old file's mapping, so it is never
+// truncated in place. A sharded data file is written shard by shard, and
+// bytesWritten is then the size of all shard files.
+bool writePatientsFile(const string& path, long long& bytesWritten) {
+    StatTimer timer(STAT_SAVE);
+    if (patients.shards.active() && path == dataFilePath) {
+        bool ok = writeShardFiles(buildShardFiles());
+        bytesWritten = shardBytes();
+        return ok;
+    }
+    if (isBinaryDataPath(path)) {
+        string snapshot = buildBinarySnapshot();
+        bytesWritten = (long long)snapshot.size();
+        if (snapshot.empty() || !writeFileAtomically(path, snapshot)) return false;
+        countBytesWritten(bytesWritten, patients.size());
+        return true;
+    }
+
+    string tmpPath = path + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file) return false;
+
+    bool ok = true;
+    string buffer;
+    bytesWritten = 0;
+    TextCursor cursor;
+    for (bool more = true; more && ok;) {
+        more = appendDataBlocks(buffer, cursor, 1 << 20);
+        ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && ok;
+        bytesWritten += buffer.size();
+        buffer.clear();
+    }
+    ok = syncFile(file) && ok;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok || !replaceFile(tmpPath, path)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    syncDirectoryOf(path);
+    if (lazyStartup && path == dataFilePath) refreshLazyIndex(path);
+    countBytesWritten(bytesWritten, patientCount());
+    return true;
+}
+
+// Data files named "*.bin" use the binary snapshot format
+bool isBinaryDataPath(const string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+}
+
+// The text columns of the store in binary snapshot order
+vector<string_view>* snapshotTextColumn(int k) {
+    vector<string_view>* columns[BINARY_TEXT_COLUMNS] = {
+        &patients.name, &patients.phone, &patients.cnic, &patients.address};
+    return columns[k];
+}
+
+// The dictionary-encoded columns of the store in binary snapshot order
+vector<uint32_t>* snapshotCodeColumn(int k) {
+    vector<uint32_t>* columns[BINARY_CODE_COLUMNS] = {
+        &patients.gender, &patients.blood, &patients.diagnosis};
+    return columns[k];
+}
+
+StringInterner* snapshotDictionary(int k) {
+    StringInterner* dictionaries[BINARY_CODE_COLUMNS] = {
+        &patients.genderDict, &patients.bloodDict, &patients.diagnosisDict};
+    return dictionaries[k];
+}
+
+// Append n bytes to out, then zero-pad it to a multiple of 8
+void appendPadded(string& out, const void* bytes, size_t n) {
+    out.append((const char*)bytes, n);
+    out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+// Encode the whole store as a binary snapshot. Equal strings are stored
+// once in the pool. Dead rows are compacted away first, since the columns
+// are written as they are. Returns an empty string if the pool would
+// exceed 4 GB.
+string buildBinarySnapshot() {
+    patients.compact();
+    size_t rows = patients.size();
+    StringInterner interner;
+    auto reference = [&](string_view text) {
+        StringInterner::Entry e = interner.entries[interner.intern(text)];
+        return BinaryTextRef{e.offset, e.length};
+    };
+
+    vector<BinaryTextRef> refs(rows * BINARY_TEXT_COLUMNS);
+    for (int k = 0; k < BINARY_TEXT_COLUMNS; ++k) {
+        const vector<string_view>& column = *snapshotTextColumn(k);
+        for (size_t i = 0; i < rows; ++i) refs[k * rows + i] = reference(column[i]);
+    }
+    vector<BinaryTextRef> dictionaryRefs;
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+        const StringInterner& dictionary = *snapshotDictionary(k);
+        for (uint32_t code = 0; code < dictionary.size(); ++code) {
+            dictionaryRefs.push_back(reference(dictionary.get(code)));
+        }
+    }
+    if (interner.pool.size() > UINT32_MAX) return string();
+    const string& pool = interner.pool;
+
+    BinarySnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BINARY_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = BINARY_SNAPSHOT_VERSION;
+    header.textColumns = BINARY_TEXT_COLUMNS;
+    header.rows = rows;
+    header.poolBytes = pool.size();
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) header.dictionaryValues[k] = snapshotDictionary(k)->size();
+
+    string out;
+    out.reserve(sizeof(header) + rows * (8 + BINARY_CODE_COLUMNS * 4 + BINARY_TEXT_COLUMNS * sizeof(BinaryTextRef)) +
+                dictionaryRefs.size() * sizeof(BinaryTextRef) + pool.size() + 64);
+    out.append((const char*)&header, sizeof(header));
+    appendPadded(out, patients.id.data(), rows * sizeof(int32_t));
+    appendPadded(out, patients.age.data(), rows * sizeof(int32_t));
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+        appendPadded(out, snapshotCodeColumn(k)->data(), rows * sizeof(uint32_t));
+    }
+    appendPadded(out, refs.data(), refs.size() * sizeof(BinaryTextRef));
+    appendPadded(out, dictionaryRefs.data(), dictionaryRefs.size() * sizeof(BinaryTextRef));
+    appendPadded(out, pool.data(), pool.size());
+
+    header.checksum = hashBytes(out.data() + sizeof(header), out.size() - sizeof(header));
+    memcpy(&out[0], &header, sizeof(header));
+    return out;
+}
+
+// Encode every patient in the patients.txt layout
+string buildTextSnapshot() {
+    string out;
+    TextCursor cursor;
+    appendDataBlocks(out, cursor, SIZE_MAX);
+    return out;
+}
+
+// Fill the store from the binary snapshot mapped in patients.source.
+// Returns the number of rows, or -2 if the snapshot is damaged.
+int loadBinarySnapshot() {
+    const char* data = patients.source.data;
+    size_t size = patients.source.size;
+    BinarySnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != BINARY_SNAPSHOT_VERSION || header.textColumns != BINARY_TEXT_COLUMNS) return -2;
+
+    auto padded = [](uint64_t n) { return (n + 7) / 8 * 8; };
+    uint64_t rows = header.rows;
+    uint64_t dictionaryTotal = 0;
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) dictionaryTotal += header.dictionaryValues[k];
+    uint64_t idOffset = sizeof(header);
+    uint64_t ageOffset = idOffset + padded(rows * 4);
+    uint64_t codeOffset = ageOffset + padded(rows * 4);
+    uint64_t refOffset = codeOffset + BINARY_CODE_COLUMNS * padded(rows * 4);
+    uint64_t dictionaryOffset = refOffset + padded(rows * BINARY_TEXT_COLUMNS * sizeof(BinaryTextRef));
+    uint64_t poolOffset = dictionaryOffset + padded(dictionaryTotal * sizeof(BinaryTextRef));
+    if (rows > (uint64_t)INT_MAX || poolOffset + padded(header.poolBytes) != size) return -2;
+    if (hashBytes(data + sizeof(header), size - sizeof(header)) != header.checksum) return -2;
+
+    const char* pool = data + poolOffset;
+    auto view = [&](const char* refs, uint64_t i, string_view& text) {
+        BinaryTextRef ref;
+        memcpy(&ref, refs + i * sizeof(ref), sizeof(ref));
+        if ((uint64_t)ref.offset + ref.length > header.poolBytes) return false;
+        text = string_view(pool + ref.offset, ref.length);
+        return true;
+    };
+
+    // Dictionaries are interned in code order, so stored codes stay valid
+    const char* dictionaryRefs = data + dictionaryOffset;
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+        StringInterner& dictionary = *snapshotDictionary(k);
+        for (uint32_t code = 0; code < header.dictionaryValues[k]; ++code) {
+            string_view text;
+            if (!view(dictionaryRefs, code, text) || dictionary.intern(text) != code) {
+                patients.clear();
+                return -2;
+            }
+        }
+        dictionaryRefs += header.dictionaryValues[k] * sizeof(BinaryTextRef);
+    }
+
+    // Numeric and code columns are copied as they are
+    patients.id.resize(rows);
+    patients.age.resize(rows);
+    memcpy(patients.id.data(), data + idOffset, rows * 4);
+    memcpy(patients.age.data(), data + ageOffset, rows * 4);
+    for (int k = 0; k < BINARY_CODE_COLUMNS; ++k) {
+        vector<uint32_t>& column = *snapshotCodeColumn(k);
+        column.resize(rows);
+        memcpy(column.data(), data + codeOffset + k * padded(rows * 4), rows * 4);
+        uint32_t maxCode = 0;
+        for (uint32_t code : column) maxCode = max(maxCode, code);
+        if (rows > 0 && maxCode >= header.dictionaryValues[k]) {
+            patients.clear();
+            return -2;
+        }
+    }
+
+    // Text columns become views into the mapped pool
+    for (int k = 0; k < BINARY_TEXT_COLUMNS; ++k) {
+        vector<string_view>& column = *snapshotTextColumn(k);
+        column.resize(rows);
+        const char* refs = data + refOffset + k * rows * sizeof(BinaryTextRef);
+        for (uint64_t i = 0; i < rows; ++i) {
+            if (!view(refs, i, column[i])) {
+                patients.clear();
+                return -2;
+            }
+        }
+    }
+
+    patients.rebuildIndex();
+    return patients.size();
+}
+
+// Convert a data file between the text and binary formats; the output
+// format follows the output file name
+bool convertPatientsFile(const string& from, const string& to) {
+    if (loadPatientsFile(from) < 0) return false;
+    long long written;
+    return writePatientsFile(to, written);
+}
+
+// Sharded data files. "--shards <n>" splits the data file into n text
+// files by ID range, "patients.0.txt" to "patients.<n-1>.txt" next to it,
+// and writes the manifest "patients.txt.shards" with one line per shard:
+//   shard|<first ID>|<patients>|<bytes of its file>
+// Once there is a manifest the data file itself is no longer read. Start-up
+// reads just the manifest; a shard is loaded the first time one of its
+// patients is looked up or changed, and listings, searches and reports load
+// all missing shards at once, in parallel. Journal and quarantine files keep
+// the data file's name; a save rewrites only the shards that changed.
+
+string shardManifestPath() {
+    return dataFilePath + ".shards";
+}
+
+// File of shard k: the data file's name with ".<k>" before the extension
+string shardPath(int k) {
+    size_t dot = dataFilePath.find_last_of('.');
+    size_t slash = dataFilePath.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash)) dot = dataFilePath.size();
+    return dataFilePath.substr(0, dot) + "." + to_string(k) + dataFilePath.substr(dot);
+}
+
+// Set up patients.shards from the manifest. Returns 1 if the data file is
+// sharded, 0 if there is no manifest, or -1 if the manifest is damaged.
+int readShardManifest() {
+    ifstream in(shardManifestPath());
+    if (!in.is_open()) return 0;
+    vector<int> first;
+    vector<long long> counts, bytes;
+    string line;
+    while (getline(in, line)) {
+        vector<string_view> fields = splitFields(line, 4);
+        if (fields.size() < 4 || fields[0] != "shard") continue;
+        int id;
+        long long count, size;
+        auto parseCount = [](string_view field, long long& value) {
+            return from_chars(field.data(), field.data() + field.size(), value).ec == errc();
+        };
+        if (!parseIntField(fields[1], id) || !parseCount(fields[2], count) || !parseCount(fields[3], size)) {
+            return -1;
+        }
+        if (!first.empty() && id <= first.back()) return -1;
+        first.push_back(id);
+        counts.push_back(count);
+        bytes.push_back(size);
+    }
+    if (first.empty() || first[0] != INT_MIN) return -1;
+    patients.shards.setLayout(first);
+    patients.shards.counts = counts;
+    patients.shards.bytes = bytes;
+    return 1;
+}
+
+string shardManifestText() {
+    const ShardSet& shards = patients.shards;
+    string out;
+    for (int k = 0; k < shards.count(); ++k) {
+        out += "shard|" + to_string(shards.first[k]) + "|" + to_string(shards.counts[k]) + "|" +
+               to_string(shards.bytes[k]) + "\n";
+    }
+    return out;
+}
+
+// Total size of the shard files
+long long shardBytes() {
+    long long total = 0;
+    for (long long bytes : patients.shards.bytes) total += bytes;
+    return total;
+}
+
+// Split the patients in the store into `count` shards of about the same
+// size by ID range. Every shard counts as loaded and changed, so the next
+// save writes them all.
+void splitIntoShards(int count) {
+    vector<int> ids;
+    ids.reserve(patients.size());
+    for (int row = 0; row < patients.rows(); ++row) {
+        if (patients.isLive(row)) ids.push_back(patients.id[row]);
+    }
+    sort(ids.begin(), ids.end());
+    vector<int> first{INT_MIN};
+    for (int k = 1; k < count && !ids.empty(); ++k) {
+        int cut = ids[ids.size() * k / count];
+        if (cut > first.back()) first.push_back(cut);
+    }
+    ShardSet& shards = patients.shards;
+    shards.setLayout(first);
+    for (int k = 0; k < shards.count(); ++k) {
+        shards.loaded[k] = true;
+        shards.dirty[k] = true;
+    }
+}
+
+// Read shards into the store, one shard per thread: each thread maps the
+// shard file and parses it into a LoadChunk, then the chunks are merged and
+// only the new rows are indexed. Shards already loaded are skipped, and a
+// missing file is an empty shard. The caller holds the store lock
+// exclusively.
+void loadShards(const vector<int>& which) {
+    ShardSet& shards = patients.shards;
+    vector<int> missing;
+    for (int k : which) {
+        if (!shards.loaded[k]) missing.push_back(k);
+    }
+    if (missing.empty()) return;
+    StatTimer timer(STAT_LOAD);
+
+    vector<LoadChunk> chunks(missing.size());
+    atomic<size_t> next{0};
+    auto load = [&]() {
+        for (size_t i; (i = next++) < missing.size();) {
+            MappedFile& file = shards.files[missing[i]];
+            file.open(shardPath(missing[i]));
+            chunks[i].begin = file.data;
+            chunks[i].size = file.size;
+            chunks[i].checked = hasBlockTrailers(file.data, file.size);
+            parseLoadChunk(chunks[i]);
+        }
+    };
+    int threads = loaderThreads > 0 ? loaderThreads : (int)thread::hardware_concurrency();
+    threads = max(min(threads, (int)missing.size()), 1);
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(load);
+    load();
+    for (thread& worker : workers) worker.join();
+
+    long long bytes = 0;
+    for (size_t i = 0; i < missing.size(); ++i) {
+        bytes += (long long)shards.files[missing[i]].size;
+        const BlockChecker& check = chunks[i].check;
+        if (check.damaged.empty()) continue;
+        string path = shardPath(missing[i]);
+        quarantineBlocks(path + ".quarantine", check.damaged);
+        quarantinedRows += (long long)check.damagedRows;
+        cout << "Warning: " << check.damagedRows << " patient rows in " << path
+             << " failed their checksum and were moved to " << path << ".quarantine.\n";
+    }
+    int from = patients.rows();
+    mergeLoadChunks(chunks);
+    patients.indexNewRows(from);
+    for (int k : missing) shards.loaded[k] = true;
+    countBytesRead(bytes, patients.rows() - from);
+}
+
+// Load the shard of patient id if the data file is sharded and it is not
+// loaded yet. Same locking as loadShards().
+void loadShardOf(int id) {
+    ShardSet& shards = patients.shards;
+    if (shards.active() && !shards.loaded[shards.of(id)]) loadShards({shards.of(id)});
+}
+
+void loadAllShards() {
+    vector<int> all(patients.shards.count());
+    for (int k = 0; k < (int)all.size(); ++k) all[k] = k;
+    loadShards(all);
+}
+
+// Make sure the shard of patient id is loaded. Readers call this before
+// taking the store lock shared; the lock is taken exclusively only when the
+// shard is missing.
+void prepareShardOf(int id) {
+    ShardSet& shards = patients.shards;
+    if (!shards.active() || shards.loaded[shards.of(id)]) return;
+    unique_lock<StoreLock> lock(storeMutex);
+    loadShardOf(id);
+}
+
+// The same for every shard, and for the records of a lazily loaded data
+// file, before a scan over all patients
+void prepareAllPatients() {
+    ShardSet& shards = patients.shards;
+    bool missing = patients.lazy.active;
+    for (int k = 0; k < shards.count(); ++k) missing = missing || !shards.loaded[k];
+    if (!missing) return;
+    unique_lock<StoreLock> lock(storeMutex);
+    loadAllShards();
+    hydrateAllPatients();
+}
+
+// Number of patients, with shards not loaded yet counted from the manifest
+// and records still only in a lazily loaded file from its index
+long long patientCount() {
+    const ShardSet& shards = patients.shards;
+    const LazyRecords& lazy = patients.lazy;
+    long long count = patients.size();
+    for (int k = 0; k < shards.count(); ++k) {
+        if (!shards.loaded[k]) count += shards.counts[k];
+    }
+    if (lazy.active) count += (long long)lazy.count - (long long)lazy.deleted.size() - lazy.overlaid;
+    return count;
+}
+
+// Text of every changed shard in the patients.txt layout, taking its
+// changed mark, followed by the manifest (shard -1). The caller holds the
+// store lock; shared is enough.
+vector<ShardFile> buildShardFiles() {
+    ShardSet& shards = patients.shards;
+    vector<char> writing(shards.count());
+    for (int k = 0; k < shards.count(); ++k) writing[k] = shards.loaded[k] && shards.dirty[k].exchange(false);
+
+    // Rows of each shard being written, in one pass over the store
+    vector<vector<int>> rowsOf(shards.count());
+    for (int row = 0; row < patients.rows(); ++row) {
+        if (!patients.isLive(row)) continue;
+        int k = shards.of(patients.id[row]);
+        if (writing[k]) rowsOf[k].push_back(row);
+    }
+    vector<ShardFile> files;
+    for (int k = 0; k < shards.count(); ++k) {
+        if (!writing[k]) continue;
+        files.push_back(ShardFile{k, string(), (long long)rowsOf[k].size()});
+        appendTextBlocks(files.back().text, rowsOf[k]);
+        shards.counts[k] = (long long)rowsOf[k].size();
+        shards.bytes[k] = (long long)files.back().text.size();
+    }
+    files.push_back(ShardFile{-1, shardManifestText(), 0});
+    return files;
+}
+
+// Write the files of buildShardFiles(), each through a synced temporary
+// file and a rename, the manifest last. A shard that could not be written
+// is marked changed again. Runs without the store lock.
+bool writeShardFiles(const vector<ShardFile>& files) {
+    bool ok = true;
+    for (const ShardFile& file : files) {
+        if (writeFileAtomically(file.shard < 0 ? shardManifestPath() : shardPath(file.shard), file.text)) {
+            countBytesWritten(file.text.size(), file.rows);
+            continue;
+        }
+        ok = false;
+        if (file.shard >= 0) patients.shards.dirty[file.shard] = true;
+    }
+    return ok;
+}
+
+// Lazy start-up ("--lazy"). Instead of parsing the whole text data file,
+// start-up maps it without reading it and maps the sidecar index
+// "<data>.idx" of ID -> line offset, which costs the same for any file
+// size. If the index is missing or belongs to another version of the data
+// file, one pass over the lines reads just their IDs and writes a new one.
+// A lookup then parses the patient's line (through a RecordCache), and a
+// change copies the record into the store first. Listings, searches and
+// reports load the whole file once; until then a save copies the lines of
+// unchanged patients over as they are. Every save of the data file writes
+// a new index for the next start.
+
+string lazyIndexPath(const string& dataPath) {
+    return dataPath + ".idx";
+}
+
+// Size and modification time of a file; false if it does not exist
+bool fileStamp(const string& path, uint64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+#ifdef _WIN32
+    mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+// ID of a line in the patients.txt layout, if its ID and age are numbers
+// (the lines a full load keeps)
+bool parseLineId(string_view line, int& id) {
+    size_t idEnd = line.find('|');
+    if (idEnd == string_view::npos || !parseIntField(line.substr(0, idEnd), id)) return false;
+    size_t nameEnd = line.find('|', idEnd + 1);
+    if (nameEnd == string_view::npos) return false;
+    size_t ageEnd = line.find('|', nameEnd + 1);
+    int age;
+    return parseIntField(line.substr(nameEnd + 1, ageEnd == string_view::npos ? string_view::npos : ageEnd - nameEnd - 1),
+                         age);
+}
+
+// Index the lines of a text data file by ID: one pass that reads only the
+// ID and age of each line, then a stable sort, so a repeated ID keeps its
+// first line. Returns true if some ID was repeated.
+bool scanLazyIndex(const char* data, size_t size, vector<LazyEntry>& entries) {
+    entries.clear();
+    size_t pos = 0;
+    while (pos < size) {
+        const char* newline = (const char*)memchr(data + pos, '\n', size - pos);
+        size_t end = newline ? (size_t)(newline - data) : size;
+        int id;
+        if (parseLineId(string_view(data + pos, end - pos), id)) entries.push_back(LazyEntry{id, 0, pos});
+        pos = end + 1;
+    }
+    stable_sort(entries.begin(), entries.end(), [](const LazyEntry& a, const LazyEntry& b) { return a.id < b.id; });
+    size_t before = entries.size();
+    entries.erase(unique(entries.begin(), entries.end(),
+                         [](const LazyEntry& a, const LazyEntry& b) { return a.id == b.id; }),
+                  entries.end());
+    return entries.size() != before;
+}
+
+// Header tying an index to the data file at dataPath, whose bytes are
+// data[0, size)
+bool lazyIndexHeader(const string& dataPath, const char* data, size_t size, LazyIndexHeader& header) {
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, LAZY_INDEX_MAGIC, sizeof header.magic);
+    if (!fileStamp(dataPath, header.dataSize, header.dataMtime) || header.dataSize != size) return false;
+    size_t tail = min(size, LAZY_TAIL_BYTES);
+    header.tailHash = hashBytes(data + size - tail, tail);
+    return true;
+}
+
+bool writeLazyIndex(const string& dataPath, const char* data, size_t size, const vector<LazyEntry>& entries,
+                    bool duplicates) {
+    LazyIndexHeader header;
+    if (!lazyIndexHeader(dataPath, data, size, header)) return false;
+    header.count = entries.size();
+    header.duplicates = duplicates;
+    string contents((const char*)&header, sizeof header);
+    contents.append((const char*)entries.data(), entries.size() * sizeof(LazyEntry));
+    return writeFileAtomically(lazyIndexPath(dataPath), contents);
+}
+
+// Write a new index for the text data file just saved at dataPath
+void refreshLazyIndex(const string& dataPath) {
+    MappedFile file;
+    if (!file.open(dataPath)) return;
+    vector<LazyEntry> entries;
+    bool duplicates = scanLazyIndex(file.data, file.size, entries);
+    writeLazyIndex(dataPath, file.data, file.size, entries, duplicates);
+}
+
+// Open the text data file at path lazily (see above). Returns the number
+// of patients in the file, or -1 if it could not be opened.
+long long openLazyPatients(const string& path) {
+    StatTimer timer(STAT_LOAD);
+    patients.clear();
+    if (!patients.source.open(path, false)) return -1;
+    LazyRecords& lazy = patients.lazy;
+    const char* data = patients.source.data;
+    size_t size = patients.source.size;
+
+    LazyIndexHeader expected, header;
+    bool current = lazyIndexHeader(path, data, size, expected) && lazy.sidecar.open(lazyIndexPath(path), false) &&
+                   lazy.sidecar.size >= sizeof header;
+    if (current) {
+        memcpy(&header, lazy.sidecar.data, sizeof header);
+        current = memcmp(header.magic, expected.magic, sizeof header.magic) == 0 &&
+                  header.dataSize == expected.dataSize && header.dataMtime == expected.dataMtime &&
+                  header.tailHash == expected.tailHash &&
+                  lazy.sidecar.size == sizeof header + header.count * sizeof(LazyEntry);
+    }
+    if (current) {
+        lazy.entries = (const LazyEntry*)(lazy.sidecar.data + sizeof header);
+        lazy.count = header.count;
+        lazy.duplicates = header.duplicates != 0;
+    } else {
+        lazy.sidecar.close();
+        patients.source.readAhead();
+        lazy.duplicates = scanLazyIndex(data, size, lazy.scanned);
+        lazy.entries = lazy.scanned.data();
+        lazy.count = lazy.scanned.size();
+        writeLazyIndex(path, data, size, lazy.scanned, lazy.duplicates);
+        countBytesRead(size, 0);
+    }
+    lazy.checked = hasBlockTrailers(data, size);
+    lazy.active = true;
+    return (long long)lazy.count;
+}
+
+// Line of patient id in a lazily loaded data file, or an empty view
+string_view lazyLine(int id) {
+    long long offset = patients.lazy.offsetOf(id);
+    if (offset < 0) return string_view();
+    const char* line = patients.source.data + offset;
+    size_t left = patients.source.size - (size_t)offset;
+    const char* newline = (const char*)memchr(line, '\n', left);
+    return string_view(line, newline ? (size_t)(newline - line) : left);
+}
+
+// End of the block of a lazily loaded data file that starts at offset:
+// the line after its trailer, or the end of the file
+size_t lazyBlockEnd(size_t offset) {
+    const MappedFile& source = patients.source;
+    if (!patients.lazy.checked) return source.size;
+    const char* end = findBlockEnd(source.data + offset, source.data + source.size);
+    return end ? (size_t)(end - source.data) : source.size;
+}
+
+// Start of the block of a lazily loaded data file that holds the line at
+// offset: the line after the previous trailer, or the start of the file
+size_t lazyBlockStart(size_t offset) {
+    const char* data = patients.source.data;
+    if (!patients.lazy.checked) return 0;
+    while (offset > 0) {
+        size_t line = offset - 1;
+        while (line > 0 && data[line - 1] != '\n') line--;
+        if (data[line] == '#' && data[line + 1] == '|') break;
+        offset = line;
+    }
+    return offset;
+}
+
+// Check the block [start, end) of a lazily loaded data file against its
+// trailer the way a full load does, once per block. A damaged block is
+// moved to the quarantine file the first time it is met, and its lines
+// then count as missing. Always true for a file without trailers.
+bool lazyBlockIntact(size_t start, size_t end) {
+    LazyRecords& lazy = patients.lazy;
+    if (!lazy.checked) return true;
+    lock_guard<mutex> guard(lazy.blockLock);
+    auto known = lazy.blocks.find(start);
+    if (known != lazy.blocks.end()) return known->second < 0;
+
+    const char* data = patients.source.data + start;
+    BlockChecker check;
+    check.start(data, data + (end - start));
+    size_t rows = 0;
+    scanPatientRows(data, end - start, [&](const string_view* fields) {
+        int id, age;
+        if (fields[0] == "#") {
+            rows = check.close(fields, rows);
+        } else if (parseIntField(fields[0], id) && parseIntField(fields[2], age)) {
+            rows++;
+        }
+    });
+    check.finish(rows, true);
+    if (check.damaged.empty()) {
+        lazy.blocks[start] = -1;
+        return true;
+    }
+    quarantineBlocks(dataFilePath + ".quarantine", check.damaged);
+    quarantinedRows += (long long)check.damagedRows;
+    lazy.blocks[start] = (long long)check.damagedRows;
+    return false;
+}
+
+// Record of patient id from a lazily loaded data file, for a patient the
+// store does not have. The caller holds the store lock, shared is enough.
+bool readLazyPatient(int id, Patient& out) {
+    LazyRecords& lazy = patients.lazy;
+    if (!lazy.active || lazy.deleted.count(id)) return false;
+    if (lazy.cache.get(id, out)) return true;
+    string_view line = lazyLine(id);
+    if (line.empty()) return false;
+    size_t offset = (size_t)(line.data() - patients.source.data);
+    size_t start = lazyBlockStart(offset);
+    if (!lazyBlockIntact(start, lazyBlockEnd(start))) return false;
+    bool found = false;
+    scanPatientRows(line.data(), line.size(), [&](const string_view* fields) {
+        int age;
+        if (!parseIntField(fields[2], age)) return;
+        out = Patient{id, string(fields[1]), age, string(fields[3]), string(fields[4]), string(fields[5]),
+                      string(fields[6]), string(fields[7]), string(fields[8])};
+        found = true;
+    });
+    if (!found) return false;
+    countBytesRead(line.size() + 1, 1);
+    lazy.cache.put(out);
+    return true;
+}
+
+// Copy the record of patient id from a lazily loaded data file into the
+// store, before it is changed. Same locking as loadShards().
+void hydratePatient(int id) {
+    LazyRecords& lazy = patients.lazy;
+    if (!lazy.active || lazy.deleted.count(id) || patients.find(id) != -1) return;
+    string_view line = lazyLine(id);
+    if (line.empty()) return;
+    size_t start = lazyBlockStart((size_t)(line.data() - patients.source.data));
+    if (!lazyBlockIntact(start, lazyBlockEnd(start))) return;
+    scanPatientRows(line.data(), line.size(), [&](const string_view* fields) {
+        int age;
+        if (!parseIntField(fields[2], age)) return;
+        patients.indexRow(patients.appendViews(id, age, fields));
+        countBytesRead(line.size() + 1, 1);
+    });
+    lazy.cache.erase(id);
+}
+
+// Parse the rest of a lazily loaded data file into the store, which then
+// works as after a full load. Records the store already has, changed ones,
+// win over their lines, and deleted patients stay deleted. Same locking as
+// loadShards().
+void hydrateAllPatients() {
+    LazyRecords& lazy = patients.lazy;
+    if (!lazy.active) return;
+    StatTimer timer(STAT_LOAD);
+    unordered_set<int> deleted = std::move(lazy.deleted);
+    unordered_map<size_t, long long> blocks = std::move(lazy.blocks);
+    lazy.clear();
+    patients.source.readAhead();
+
+    vector<string_view> damaged;
+    size_t damagedRows = 0;
+    int from = patients.rows();
+    parsePatientsParallel(loadThreadCount(patients.source.size), damaged, damagedRows);
+    // Blocks found damaged while the file was read lazily are quarantined already
+    damaged.erase(remove_if(damaged.begin(), damaged.end(),
+                            [&](string_view block) {
+                                auto known = blocks.find((size_t)(block.data() - patients.source.data));
+                                if (known == blocks.end() || known->second < 0) return false;
+                                damagedRows -= (size_t)known->second;
+                                return true;
+                            }),
+                  damaged.end());
+    if (!damaged.empty()) {
+        quarantineBlocks(dataFilePath + ".quarantine", damaged);
+        quarantinedRows += (long long)damagedRows;
+        cout << "Warning: " << damagedRows << " patient rows in " << dataFilePath
+             << " failed their checksum and were moved to " << dataFilePath << ".quarantine.\n";
+    }
+    patients.indexNewRows(from);
+    for (int id : deleted) {
+        int row = patients.find(id);
+        if (row != -1) patients.erase(row);
+    }
+    countBytesRead(patients.source.size, patients.rows() - from);
+}
+
+// Bring patient id into the store if it is only on disk so far: its shard,
+// or its record in lazy mode. Same locking as loadShards().
+void loadPatientOf(int id) {
+    loadShardOf(id);
+    hydratePatient(id);
+}
+
+// Function to save patient data to "patients.txt" file before the program exits
+void saveToFile() {
+    clear();
+    if (interactive) {
+        cout << "Saving patient data...\n";
+        cout.flush();
+    }
+
+    if (!writeDataFile()) {
+        clear();
+        cout << "Failed to save data to file.\n";
+    }
+}
+
+// Write the whole store to the data file and start a new journal
+bool writeDataFile() {
+    // Neither a background rewrite nor a compaction still writing the data
+    // file may race this save
+    waitForPersistence();
+    if (journal.compactor.joinable()) journal.compactor.join();
+
+    long long written;
+    if (!writePatientsFile(dataFilePath, written)) return false;
+    // The new data file contains every journaled change
+    resetJournal(written);
+    return true;
+}
+
+string journalPath() {
+    return dataFilePath + ".wal";
+}
+
+string journalOldPath() {
+    return dataFilePath + ".wal.old";
+}
+
+void openJournal() {
+    if (journal.file) return;
+    journal.file = fopen(journalPath().c_str(), "ab");
+    if (!journal.file) return;
+    fseek(journal.file, 0, SEEK_END);
+    journal.bytes = ftell(journal.file);
+}
+
+// Apply the records of one journal file to the store. A final line without
+// its newline was cut off by a crash and is ignored. With a sharded data
+// file, the shard of every replayed patient is loaded first. Returns the
+// number of records applied, or -1 if the file does not exist.
+int replayJournalFile(const string& path) {
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in.is_open()) return -1;
+    // Replayed rows point into the log, so it is read straight into the
+    // store's text arena, which must not be rebuilt under the loop below
+    size_t size = (size_t)in.tellg();
+    in.seekg(0);
+    char* buffer = patients.text.allocate(max(size, (size_t)1));
+    in.read(buffer, size);
+    string_view log(buffer, (size_t)in.gcount());
+    patients.pinText = true;
+
+    int applied = 0;
+    size_t pos = 0;
+    while (pos < log.size()) {
+        size_t end = log.find('\n', pos);
+        if (end == string_view::npos) break;
+        string_view line = log.substr(pos, end - pos);
+        pos = end + 1;
+        if (line.size() < 2 || line[1] != '|') continue;
+
+        if (line[0] == '+') {
+            scanPatientRows(line.data() + 2, line.size() - 2, [&](const string_view* fields) {
+                int id, age;
+                if (!parseIntField(fields[0], id) || !parseIntField(fields[2], age)) return;
+                loadShardOf(id);
+                patients.upsertViews(id, age, fields);
+                applied++;
+            });
+        } else if (line[0] == '-') {
+            int id;
+            if (!parseIntField(line.substr(2), id)) continue;
+            int row = findPatientIndexByID(id);
+            if (row != -1) patients.erase(row);
+            applied++;
+        }
+    }
+    patients.pinText = false;
+    patients.compactText();
+    countBytesRead(log.size(), applied);
+    return applied;
+}
+
+// Queue one record for the journal writer and apply the compaction policy.
+// Called with the store locked exclusively, so records queue in the order
+// the changes were made.
+void journalAppend(const string& record) {
+    if (!journal.file) openJournal();
+    if (!journal.file) {
+        // The journal cannot be written; fall back to a full save
+        requestDataFileRewrite();
+        return;
+    }
+    startJournalWriter();
+    {
+        lock_guard<mutex> guard(journal.queueLock);
+        journal.pending += record;
+        journal.pendingRecords++;
+        journal.queuedSeq++;
+    }
+    journal.wake.notify_one();
+    journal.bytes += record.size();
+
+    if (journal.bytes >= max(JOURNAL_MIN_COMPACT_BYTES, journal.snapshotBytes)) {
+        startJournalCompaction();
+    }
+}
+
+void startJournalWriter() {
+    if (!journal.writer.joinable()) journal.writer = thread(journalWriterLoop);
+}
+
+// Mark the data file as behind the store; the writer rewrites it after
+// JOURNAL_REWRITE_DELAY_MS, together with every change made until then
+void requestDataFileRewrite() {
+    startJournalWriter();
+    {
+        lock_guard<mutex> guard(journal.queueLock);
+        journal.queuedSeq++;
+        if (!journal.rewritePending) {
+            journal.rewritePending = true;
+            journal.rewriteSeq = journal.queuedSeq;
+            journal.rewriteDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(JOURNAL_REWRITE_DELAY_MS);
+        }
+    }
+    journal.wake.notify_one();
+}
+
+// Body of the writer thread. Each round takes whatever was queued, writes
+// it, and syncs when the policy (or a waiting barrier) says so. Records
+// queued during a write or sync go out together in the next round. On
+// stop, everything still queued is written and synced first.
+void journalWriterLoop() {
+    using std::chrono::steady_clock;
+    const auto syncInterval = std::chrono::milliseconds(JOURNAL_SYNC_INTERVAL_MS);
+    string batch;
+    long long& unsyncedRecords = journal.unsyncedRecords;
+    auto lastSync = steady_clock::now();
+
+    unique_lock<mutex> lock(journal.queueLock);
+    while (true) {
+        // Sleep until there are records, a due rewrite, a barrier, a stop,
+        // or unsynced records whose sync interval ran out, and while another
+        // thread holds the file
+        while (journal.fileHeld || (journal.pending.empty() && !journal.syncRequested && !journal.stopping)) {
+            if (journal.fileHeld) {
+                journal.wake.wait(lock);
+                continue;
+            }
+            bool rewriteWaits = journal.rewritePending;
+            auto now = steady_clock::now();
+            if (rewriteWaits && now >= journal.rewriteDue) break;
+            if (unsyncedRecords > 0 && now >= lastSync + syncInterval) break;
+            if (!rewriteWaits && unsyncedRecords == 0) {
+                journal.wake.wait(lock);
+                continue;
+            }
+            auto until = unsyncedRecords > 0 ? lastSync + syncInterval : journal.rewriteDue;
+            if (rewriteWaits) until = min(until, journal.rewriteDue);
+            journal.wake.wait_until(lock, until);
+        }
+        bool urgent = journal.syncRequested || journal.stopping;
+        bool rewrite = journal.rewritePending && (urgent || steady_clock::now() >= journal.rewriteDue);
+        if (journal.stopping && journal.pending.empty() && !rewrite && unsyncedRecords == 0) break;
+
+        // Changes up to doneSeq are handled by this round, except a rewrite
+        // that is not due yet
+        uint64_t doneSeq = journal.queuedSeq;
+        if (journal.rewritePending && !rewrite) doneSeq = journal.rewriteSeq - 1;
+        long long records = journal.pendingRecords;
+        batch.swap(journal.pending);
+        journal.pendingRecords = 0;
+        journal.syncRequested = false;
+        if (rewrite) journal.rewritePending = false;
+        journal.writing = true;
+        lock.unlock();
+
+        bool ok = true;
+        if (!batch.empty()) {
+            // Once written, records survive a crash of the program itself
+            ok = fwrite(batch.data(), 1, batch.size(), journal.file) == batch.size();
+            ok = fflush(journal.file) == 0 && ok;
+            countBytesWritten(batch.size(), records);
+            unsyncedRecords += records;
+            batch.clear();
+        }
+        if (unsyncedRecords > 0 &&
+            (urgent || unsyncedRecords >= JOURNAL_SYNC_RECORDS || steady_clock::now() >= lastSync + syncInterval)) {
+            ok = syncFile(journal.file) && ok;
+            unsyncedRecords = 0;
+            lastSync = steady_clock::now();
+        }
+
+        // The rewrite takes the store lock, which a thread waiting in
+        // waitForJournalWrites() may hold; let that thread go first
+        lock.lock();
+        journal.writing = false;
+        journal.written.notify_all();
+        lock.unlock();
+        if (rewrite) rewriteDataFileFromWriter();
+
+        lock.lock();
+        if (!ok) journal.failed = true;
+        if (unsyncedRecords == 0) journal.durableSeq = max(journal.durableSeq, doneSeq);
+        journal.written.notify_all();
+    }
+}
+
+// Rewrite the whole data file for requestDataFileRewrite(). The snapshot is
+// taken under the store lock and written without it.
+void rewriteDataFileFromWriter() {
+    StatTimer timer(STAT_SAVE);
+    if (patients.shards.active()) {
+        // Only the changed shards
+        vector<ShardFile> files;
+        {
+            shared_lock<StoreLock> lock(storeMutex);
+            files = buildShardFiles();
+        }
+        if (!writeShardFiles(files)) {
+            lock_guard<mutex> guard(journal.queueLock);
+            journal.failed = true;
+        }
+        return;
+    }
+    string snapshot;
+    int rows;
+    if (isBinaryDataPath(dataFilePath)) {
+        // Building a binary snapshot compacts the store first
+        unique_lock<StoreLock> lock(storeMutex);
+        snapshot = buildBinarySnapshot();
+        rows = patients.size();
+    } else {
+        shared_lock<StoreLock> lock(storeMutex);
+        snapshot = buildTextSnapshot();
+        rows = (int)patientCount();
+    }
+    bool ok = !snapshot.empty() || rows == 0;
+    if (ok && writeFileAtomically(dataFilePath, snapshot)) {
+        if (lazyStartup && !isBinaryDataPath(dataFilePath)) refreshLazyIndex(dataFilePath);
+        countBytesWritten(snapshot.size(), rows);
+    } else {
+        lock_guard<mutex> guard(journal.queueLock);
+        journal.failed = true;
+    }
+}
+
+// Wait until the writer has handed every record queued so far to the OS
+void waitForJournalWrites() {
+    unique_lock<mutex> lock(journal.queueLock);
+    journal.written.wait(lock, []() { return journal.pending.empty() && !journal.writing; });
+}
+
+// Take journal.file from the writer to sync, close or rotate it: wait
+// until every record queued so far is written, then keep the writer from
+// starting another round (its interval sync included) until
+// releaseJournalFile()
+void holdJournalFile() {
+    unique_lock<mutex> lock(journal.queueLock);
+    journal.written.wait(lock, []() { return journal.pending.empty() && !journal.writing && !journal.fileHeld; });
+    journal.fileHeld = true;
+}
+
+// Give journal.file back to the writer. The records written to the file it
+// held no longer need a sync: they were synced, or a new data file holds
+// them. If that failed (ok is false), the next barrier reports it.
+void releaseJournalFile(bool ok) {
+    {
+        lock_guard<mutex> guard(journal.queueLock);
+        journal.fileHeld = false;
+        journal.unsyncedRecords = 0;
+        if (!ok) journal.failed = true;
+    }
+    journal.wake.notify_one();
+}
+
+// Close the journal file, for good or until openJournal()
+void closeJournal() {
+    holdJournalFile();
+    if (journal.file) fclose(journal.file);
+    journal.file = nullptr;
+    releaseJournalFile(true);
+}
+
+// Durability barrier: wait until every change queued so far is synced to
+// disk (journal records) or written into the data file (without a
+// journal). Returns false if a write failed since the previous barrier.
+bool waitForPersistence() {
+    unique_lock<mutex> lock(journal.queueLock);
+    uint64_t target = journal.queuedSeq;
+    if (journal.durableSeq < target) {
+        journal.syncRequested = true;
+        journal.wake.notify_one();
+        journal.written.wait(lock, [target]() { return journal.durableSeq >= target; });
+    }
+    bool ok = !journal.failed;
+    journal.failed = false;
+    return ok;
+}
+
+Journal::~Journal() {
+    if (writer.joinable()) {
+        {
+            lock_guard<mutex> guard(queueLock);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    if (compactor.joinable()) compactor.join();
+    if (file) fclose(file);
+}
+
+void journalUpsert(int row) {
+    string record = "+|";
+    appendPatientLine(record, row);
+    journalAppend(record);
+}
+
+void journalDelete(int id) {
+    journalAppend("-|" + to_string(id) + "\n");
+}
+
+// Rotate the active journal and write a new data file in the background.
+// Called with the store locked exclusively, so only the rotation happens
+// here: the compactor thread takes the store lock itself to build the
+// snapshot, like rewriteDataFileFromWriter(). Changes made in between are
+// in the new journal as well, and replaying them again is harmless.
+void startJournalCompaction() {
+    if (journal.compacting) return;
+    if (journal.compactor.joinable()) journal.compactor.join();
+
+    holdJournalFile();
+    bool synced = syncFile(journal.file);
+    fclose(journal.file);
+    journal.file = nullptr;
+
+    ifstream oldLog(journalOldPath(), ios::binary);
+    if (oldLog.is_open()) {
+        // The previous compaction failed: keep its log and add this one to it
+        oldLog.close();
+        ifstream active(journalPath(), ios::binary);
+        ofstream combined(journalOldPath(), ios::binary | ios::app);
+        combined << active.rdbuf();
+        combined.close();
+        active.close();
+        remove(journalPath().c_str());
+    } else {
+        replaceFile(journalPath(), journalOldPath());
+    }
+    openJournal();
+    releaseJournalFile(synced);
+
+    journal.compacting = true;
+    journal.compactor = thread(compactJournal, journalOldPath(), dataFilePath);
+}
+
+// Body of the compactor thread: snapshot the store under its lock, write it
+// without the lock, then drop the rotated journal it replaces.
+// snapshotBytes is only set under the store lock, which journalAppend()
+// holds exclusively when it reads it.
+void compactJournal(string oldPath, string dataPath) {
+    bool ok;
+    if (patients.shards.active()) {
+        // Only the changed shards are written
+        vector<ShardFile> files;
+        {
+            shared_lock<StoreLock> lock(storeMutex);
+            files = buildShardFiles();
+            journal.snapshotBytes = shardBytes();
+        }
+        ok = writeShardFiles(files);
+    } else {
+        string snapshot;
+        if (isBinaryDataPath(dataPath)) {
+            // Building a binary snapshot compacts the store first
+            unique_lock<StoreLock> lock(storeMutex);
+            snapshot = buildBinarySnapshot();
+            journal.snapshotBytes = (long long)snapshot.size();
+        } else {
+            shared_lock<StoreLock> lock(storeMutex);
+            snapshot = buildTextSnapshot();
+            journal.snapshotBytes = (long long)snapshot.size();
+        }
+        ok = writeFileAtomically(dataPath, snapshot);
+        if (ok && lazyStartup && !isBinaryDataPath(dataPath)) refreshLazyIndex(dataPath);
+    }
+    if (ok) remove(oldPath.c_str());
+    journal.compacting = false;
+}
+
+// Start over with empty journals after a full data file was written
+void resetJournal(long long snapshotBytes) {
+    if (journal.compactor.joinable()) journal.compactor.join();
+    closeJournal();
+    remove(journalOldPath().c_str());
+    remove(journalPath().c_str());
+    journal.snapshotBytes = snapshotBytes;
+    journal.bytes = 0;
+    if (journal.enabled) openJournal();
+}
+
+// Record an added or edited patient on disk: one journal record in
+// journaling mode, otherwise a rewrite of the whole data file. Either way
+// the writer thread does the writing; this only queues it.
+void persistPatient(int row) {
+    if (journal.enabled) {
+        journalUpsert(row);
+    } else {
+        requestDataFileRewrite();
+    }
+}
+
+// Record a deleted patient on disk
+void persistDeletion(int id) {
+    if (journal.enabled) {
+        journalDelete(id);
+    } else {
+        requestDataFileRewrite();
+    }
+}
+
+// Copy of the record of patient id; false if there is none
+bool lookupPatient(int id, Patient& out) {
+    StatTimer timer(STAT_LOOKUP);
+    prepareShardOf(id);
+    shared_lock<StoreLock> lock(storeMutex);
+    int idx = patients.find(id);
+    if (idx == -1) return readLazyPatient(id, out);
+    out = patients.get(idx);
+    return true;
+}
+
+// The store operations below are safe to call from any thread. Each one
+// looks the patient up again under the exclusive lock, so a record another
+// client changed in the meantime is never overwritten by a stale row number.
+StoreStatus insertPatient(Patient p) {
+    StatTimer timer(STAT_ADD);
+    unique_lock<StoreLock> lock(storeMutex);
+    if (findPatientIndexByID(p.id) != -1) return STORE_DUPLICATE_ID;
+    persistPatient(patients.append(std::move(p)));
+    return STORE_OK;
 }
 
-// Recursive function to find patient index by ID
-// Returns the index of the patient in the array (0..patientCount-1), or -1 if not found
-int findPatientIndexByID(int id, int idx) {
-    if (idx >= patientCount) return -1;
-    if (patients[idx][0].id == id) return idx;
-    return findPatientIndexByID(id, idx + 1);
+// Overwrite every field of patient id; the ID itself never changes
+StoreStatus replacePatient(int id, Patient p) {
+    StatTimer timer(STAT_UPDATE);
+    unique_lock<StoreLock> lock(storeMutex);
+    int idx = findPatientIndexByID(id);
+    if (idx == -1) return STORE_NOT_FOUND;
+    p.id = id;
+    patients.set(idx, std::move(p));
+    persistPatient(idx);
+    return STORE_OK;
 }
 
-// Function to swap two Patient objects
-void swapPatients(int idx1, int idx2) {
-    Patient temp = patients[idx1][0];
-    patients[idx1][0] = patients[idx2][0];
-    patients[idx2][0] = temp;
+StoreStatus diagnosePatientRecord(int id, const string& diagnosis) {
+    StatTimer timer(STAT_UPDATE);
+    unique_lock<StoreLock> lock(storeMutex);
+    int idx = findPatientIndexByID(id);
+    if (idx == -1) return STORE_NOT_FOUND;
+    if (!patients.diagnosisOf(idx).empty()) return STORE_HAS_DIAGNOSIS;
+    patients.setDiagnosis(idx, diagnosis);
+    persistPatient(idx);
+    return STORE_OK;
 }
 
-#include <algorithm> // for std::swap
+StoreStatus removePatient(int id) {
+    StatTimer timer(STAT_DELETE);
+    unique_lock<StoreLock> lock(storeMutex);
+    int idx = findPatientIndexByID(id);
+    if (idx == -1) return STORE_NOT_FOUND;
+    patients.erase(idx);
+    persistDeletion(id);
+    return STORE_OK;
+}
 
-// Recursive sort function (recursive bubble sort) based on patient ID ascending
-void sortPatientsByID(int n, bool ascending) {
-    if (n <= 1) return;
-    for (int i = 0; i < n - 1; ++i) {
-        bool condition = ascending ? (patients[i][0].id > patients[i + 1][0].id) : (patients[i][0].id < patients[i + 1][0].id);
-        if (condition) {
-            swapPatients(i, i + 1);
-        }
+// Split a line at '|' into at most maxFields fields; the last field keeps
+// any further '|'
+vector<string_view> splitFields(string_view line, int maxFields) {
+    vector<string_view> fields;
+    while ((int)fields.size() + 1 < maxFields) {
+        size_t bar = line.find('|');
+        if (bar == string_view::npos) break;
+        fields.push_back(line.substr(0, bar));
+        line.remove_prefix(bar + 1);
     }
-    sortPatientsByID(n - 1, ascending);
+    fields.push_back(line);
+    return fields;
 }
 
-// Recursive sort function (recursive bubble sort) based on patient name ascending
-void sortPatientsByName(int n, bool ascending) {
-    if (n <= 1) return;
-    for (int i = 0; i < n - 1; ++i) {
-        bool condition = ascending ? (patients[i][0].name > patients[i + 1][0].name) : (patients[i][0].name < patients[i + 1][0].name);
-        if (condition) {
-            swapPatients(i, i + 1);
+// Apply one batch command to the store. Commands use the patients.txt
+// field layout after the command name:
+//   add|id|name|age|gender|blood|phone|cnic|address[|diagnosis]
+//   diagnose|id|diagnosis
+//   update|id|name|age|gender|blood|phone|cnic|address|diagnosis
+//   delete|id
+// An empty update field keeps the current value. The same checks as the
+// menus apply; on failure error says why and the store is unchanged.
+bool applyBatchCommand(string_view line, string& error) {
+    vector<string_view> fields = splitFields(line, 10);
+    string_view command = fields[0];
+    if (command != "add" && command != "update" && command != "diagnose" && command != "delete") {
+        error = "unknown command \"" + string(command) + "\"";
+        return false;
+    }
+    StatTimer timer(command == "add" ? STAT_ADD : (command == "delete" ? STAT_DELETE : STAT_UPDATE));
+    int id;
+    if (fields.size() < 2 || !parseIntField(fields[1], id)) {
+        error = "missing or invalid patient ID";
+        return false;
+    }
+    int idx = findPatientIndexByID(id);
+
+    if (command == "add" || command == "update") {
+        if (fields.size() < 9) {
+            error = "expected name, age, gender, blood type, phone, CNIC and address";
+            return false;
+        }
+        if (command == "add" && idx != -1) {
+            error = "ID is already registered";
+            return false;
+        }
+        if (command == "update" && idx == -1) {
+            error = "patient with that ID not found";
+            return false;
+        }
+        Patient p;
+        if (command == "update") {
+            p = patients.get(idx);
+        } else {
+            p.id = id;
+            p.age = 0;
+        }
+        bool keepEmpty = command == "update";
+        string name(fields[2]), ageText(fields[3]), gender(fields[4]), blood(fields[5]);
+        if (!(keepEmpty && name.empty())) {
+            if (!isValidName(name)) {
+                error = "invalid name";
+                return false;
+            }
+            p.name = name;
+        }
+        if (!(keepEmpty && ageText.empty()) && !isValidAge(ageText, p.age)) {
+            error = "invalid age";
+            return false;
+        }
+        if (!(keepEmpty && gender.empty())) {
+            if (!isValidGender(gender)) {
+                error = "invalid gender";
+                return false;
+            }
+            p.gender = gender;
         }
+        if (!(keepEmpty && blood.empty())) {
+            if (!isValidBloodType(blood)) {
+                error = "invalid blood type";
+                return false;
+            }
+            p.blood = blood;
+        }
+        if (!(keepEmpty && fields[6].empty())) p.phone = string(fields[6]);
+        if (!(keepEmpty && fields[7].empty())) p.cnic = string(fields[7]);
+        if (!(keepEmpty && fields[8].empty())) p.address = string(fields[8]);
+        if (fields.size() > 9 && !fields[9].empty()) p.diagnosis = string(fields[9]);
+        if (command == "add") {
+            patients.append(std::move(p));
+        } else {
+            patients.set(idx, std::move(p));
+        }
+        return true;
+    }
+    if (idx == -1) {
+        error = "patient with that ID not found";
+        return false;
+    }
+    if (command == "diagnose") {
+        if (!patients.diagnosisOf(idx).empty()) {
+            error = "patient already has a diagnosis";
+            return false;
+        }
+        patients.setDiagnosis(idx, fields.size() > 2 ? fields[2] : string_view());
+        return true;
     }
-    sortPatientsByName(n - 1, ascending);
+    // delete
+    patients.erase(idx);
+    return true;
 }
 
-void loadFromFile() {
-    clear();
-    cout << "Loading patient data";
-    for (int i = 0; i < 3; ++i) {
-        cout << ".";
-        cout.flush();
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+// Entry point for "--batch [file]": apply every command of the file (or of
+// standard input for "-") to the loaded patients, then write the data file
+// once. Blank lines and lines starting with '#' are skipped. Returns the
+// process exit code.
+int runBatch(const string& path) {
+    interactive = false;
+    journal.enabled = false; // the single save at the end replaces the journal
+
+    ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file.is_open()) {
+            cout << "Failed to open batch file " << path << ".\n";
+            return 1;
+        }
     }
-    cout << "\n";
-    clear();
+    istream& in = path == "-" ? cin : file;
 
-    ifstream inFile("patients.txt");
-    if (!inFile.is_open()) {
-        // If the file does not exist or failed to open, just return
-        return;
+    loadFromFile();
+
+    auto start = std::chrono::steady_clock::now();
+    string line, error;
+    long long lineNumber = 0, applied = 0, failed = 0;
+    while (getline(in, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        if (applyBatchCommand(line, error)) {
+            applied++;
+        } else {
+            failed++;
+            cout << "Line " << lineNumber << ": " << error << "\n";
+        }
     }
+    double applySeconds = secondsSince(start);
 
-    string line;
-    patientCount = 0;
+    cout << "Applied " << applied << " operations (" << failed << " failed) in " << applySeconds << " s, "
+         << (applySeconds > 0 ? applied / applySeconds : 0) << " ops/s\n";
+    if (applied > 0) {
+        start = std::chrono::steady_clock::now();
+        if (!writeDataFile()) {
+            cout << "Failed to save data to file.\n";
+            return 1;
+        }
+        cout << "Saved " << patientCount() << " patients to " << dataFilePath << " in " << secondsSince(start) << " s\n";
+    }
+    return failed > 0 ? 2 : 0;
+}
 
-    while (getline(inFile, line) && patientCount < MAX_PATIENTS) {
-        // Storage format: id|name|age|gender|blood|phone|cnic|address|diagnosis
-        size_t pos = 0;
-        size_t nextPos;
-        string fields[9];
+// Answer one request of the server protocol and append the response to
+// out. Requests are the batch commands (add, diagnose, update, delete) plus
+// three queries, one per line:
+//   get|id           -> OK|<record in the patients.txt layout>
+//   count|diagnosis  -> OK|<patients>
+//   blood|type       -> OK|<patients>|<id>,<id>,...  (ascending IDs)
+//   name|prefix      -> OK|<patients>|<id>,<id>,...  (up to 20, name order)
+//   similar|text     -> OK|<patients>|<id>,<id>,...  (up to 10, best first)
+//   ids|from|to      -> OK|<patients>|<id>,<id>,...  (IDs from..to, ascending)
+//   ages|from|to     -> OK|<patients>|<id>,<id>,...  (aged from..to, by age)
+//   bounds           -> OK|<lowest id>|<highest id>|<youngest>|<oldest>
+//   stats            -> OK|<runtime statistics as JSON>
+// A mutation answers "OK" once it is applied and journaled. Any failure
+// answers "ERR|<reason>". Every request gets exactly one response line.
+void handleServerRequest(string_view line, string& out) {
+    vector<string_view> fields = splitFields(line, 2);
+    string_view command = fields[0];
+    string_view argument = fields.size() > 1 ? fields[1] : string_view();
 
-        for (int i = 0; i < 8; ++i) {
-            nextPos = line.find('|', pos);
-            if (nextPos == string::npos) {
-                fields[i] = line.substr(pos);
-                pos = line.length();
-            } else {
-                fields[i] = line.substr(pos, nextPos - pos);
-                pos = nextPos + 1;
+    if (command == "stats") {
+        out += "OK|" + statsJson() + "\n";
+        return;
+    }
+    if (command == "group" || command == "watch") {
+        vector<GroupField> fields;
+        if (!parseGroupFields(argument, fields)) {
+            out += "ERR|unknown or repeated report field\n";
+            return;
+        }
+        prepareAllPatients();
+        if (command == "watch") {
+            unique_lock<StoreLock> lock(storeMutex);
+            materializeReport(fields);
+            out += "OK\n";
+            return;
+        }
+        shared_lock<StoreLock> lock(storeMutex);
+        vector<GroupReportRow> report = groupPatients(fields);
+        lock.unlock();
+        out += "OK|" + to_string(report.size());
+        char numbers[96];
+        for (const GroupReportRow& row : report) {
+            out += '|';
+            for (const string& label : row.key) out += label + ";";
+            const GroupStats& s = row.stats;
+            snprintf(numbers, sizeof numbers, "%llu;%d;%.2f;%d;", (unsigned long long)s.count, s.minAge, s.meanAge(),
+                     s.maxAge);
+            out += numbers;
+            for (int b = 0; b < AGE_BRACKETS; ++b) {
+                if (b > 0) out += ',';
+                out += to_string(s.histogram[b]);
+            }
+        }
+        out += '\n';
+        return;
+    }
+    if (command == "ids" || command == "ages" || command == "bounds") {
+        // An empty bound leaves that end of the range open
+        vector<string_view> bounds = splitFields(argument, 2);
+        int from = INT_MIN, to = INT_MAX;
+        bool valid = command == "bounds" ||
+                     ((bounds[0].empty() || parseIntField(bounds[0], from)) && bounds.size() == 2 &&
+                      (bounds[1].empty() || parseIntField(bounds[1], to)));
+        if (!valid) {
+            out += "ERR|expected " + string(command) + "|from|to\n";
+            return;
+        }
+        prepareAllPatients();
+        shared_lock<StoreLock> lock(storeMutex);
+        if (command == "bounds") {
+            int lowestId, highestId, youngest, oldest;
+            if (!patientBounds(lowestId, highestId, youngest, oldest)) {
+                out += "ERR|no patients\n";
+                return;
             }
+            out += "OK|" + to_string(lowestId) + "|" + to_string(highestId) + "|" + to_string(youngest) + "|" +
+                   to_string(oldest) + "\n";
+            return;
+        }
+        vector<int> matches = command == "ids" ? patientIdsInRange(from, to) : patientIdsInAgeRange(from, to);
+        lock.unlock();
+        out += "OK|" + to_string(matches.size()) + "|";
+        for (size_t i = 0; i < matches.size(); ++i) {
+            if (i > 0) out += ',';
+            out += to_string(matches[i]);
         }
-        // The remainder after the 8th delimiter is diagnosis
-        if (pos < line.length()) {
-            fields[8] = line.substr(pos);
+        out += '\n';
+        return;
+    }
+    if (command == "get" || command == "count" || command == "blood" || command == "name" || command == "similar") {
+        int id = 0;
+        bool validId = command == "get" && parseIntField(argument, id);
+        if (validId) {
+            prepareShardOf(id);
+        } else if (command != "get") {
+            prepareAllPatients();
+        }
+        shared_lock<StoreLock> lock(storeMutex);
+        if (command == "get") {
+            StatTimer timer(STAT_LOOKUP);
+            int idx = validId ? patients.find(id) : -1;
+            Patient p;
+            if (idx == -1 && validId && readLazyPatient(id, p)) {
+                out += "OK|" + formatPatientLine(p) + "\n";
+                return;
+            }
+            if (idx == -1) {
+                out += "ERR|patient with that ID not found\n";
+                return;
+            }
+            out += "OK|";
+            appendPatientLine(out, idx);
+        } else if (command == "count") {
+            long long code = patients.diagnosisDict.find(argument);
+            size_t count = code >= 0 ? patients.diagnosisIndex.count((uint32_t)code) : 0;
+            out += "OK|" + to_string(count) + "\n";
         } else {
-            fields[8] = "";
+            vector<int> matches;
+            if (command == "blood") {
+                long long code = patients.bloodDict.find(argument);
+                if (code >= 0) matches = patients.bloodIndex.ids((uint32_t)code);
+                sort(matches.begin(), matches.end());
+            } else if (command == "name") {
+                for (int row : searchNamesByPrefix(argument, 20)) matches.push_back(patients.id[row]);
+            } else {
+                for (const NameMatch& match : searchNamesFuzzy(argument, 10)) matches.push_back(patients.id[match.row]);
+            }
+            out += "OK|" + to_string(matches.size()) + "|";
+            for (size_t i = 0; i < matches.size(); ++i) {
+                if (i > 0) out += ',';
+                out += to_string(matches[i]);
+            }
+            out += '\n';
         }
+        return;
+    }
 
-        // Assign to Patient struct
-        patients[patientCount][0].id = stoi(fields[0]);
-        patients[patientCount][0].name = fields[1];
-        patients[patientCount][0].age = stoi(fields[2]);
-        patients[patientCount][0].gender = fields[3];
-        patients[patientCount][0].blood = fields[4];
-        patients[patientCount][0].phone = fields[5];
-        patients[patientCount][0].cnic = fields[6];
-        patients[patientCount][0].address = fields[7];
-        patients[patientCount][0].diagnosis = fields[8];
-
-        patientCount++;
+    unique_lock<StoreLock> lock(storeMutex);
+    string error;
+    if (!applyBatchCommand(line, error)) {
+        out += "ERR|" + error + "\n";
+        return;
     }
+    int id;
+    parseIntField(splitFields(argument, 2)[0], id);
+    if (command == "delete") {
+        persistDeletion(id);
+    } else {
+        persistPatient(patients.find(id));
+    }
+    out += "OK\n";
+}
 
-    inFile.close();
+#ifdef PATIENT_HAVE_SERVER
+// Set by SIGINT/SIGTERM; the server loop saves and exits when it sees it
+volatile sig_atomic_t serverStopRequested = 0;
+
+void requestServerStop(int) {
+    serverStopRequested = 1;
 }
 
-// Function to save patient data to "patients.txt" file before the program exits
-void saveToFile() {
-    clear();
-    cout << "Saving patient data";
-    for (int i = 0; i < 3; ++i) {
-        cout << ".";
-        cout.flush();
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+// A client of the server. Requests are read into `in` and answered in order
+// into `out`, so a client may pipeline as many requests as it likes.
+struct ServerConnection {
+    string in;
+    string out;
+    size_t sent = 0;      // bytes of out already sent
+    uint32_t events = 0;  // epoll events currently armed
+    bool finished = false; // the client sent everything; hang up once out is sent
+};
+
+// A client stops being read while this much output waits for it
+const size_t SERVER_MAX_PENDING_OUTPUT = 4 << 20;
+
+// Or while this much of its input waits to be answered. A request line
+// that does not fit is refused and the client hung up on.
+const size_t SERVER_MAX_PENDING_INPUT = 1 << 20;
+
+// Send as much pending output as the socket takes; false if the client is gone
+bool flushServerConnection(int fd, ServerConnection& conn) {
+    while (conn.sent < conn.out.size()) {
+        ssize_t n = send(fd, conn.out.data() + conn.sent, conn.out.size() - conn.sent, MSG_NOSIGNAL);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        conn.sent += (size_t)n;
     }
-    cout << "\n";
+    conn.out.clear();
+    conn.sent = 0;
+    return true;
+}
 
-    ofstream outFile("patients.txt", ios::out);
-    if (!outFile.is_open()) {
-        clear();
+// Entry point for "--serve [socket]": keep the patients in memory and answer
+// requests from any number of local clients on a Unix domain socket. One
+// thread runs an epoll loop over non-blocking sockets; every readable
+// client has all of its complete request lines answered at once, and the
+// answers go out in as few writes as the socket allows. SIGINT or SIGTERM
+// writes the data file and stops the server.
+int runServer(const string& socketPath) {
+    interactive = false;
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cout << "Socket path " << socketPath << " is too long.\n";
+        return 1;
+    }
+    memcpy(address.sun_path, socketPath.data(), socketPath.size());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socketPath.c_str());
+    if (listener < 0 || ::bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0) {
+        cout << "Failed to listen on " << socketPath << ".\n";
+        return 1;
+    }
+
+    loadFromFile();
+
+    int poller = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = listener;
+    epoll_ctl(poller, EPOLL_CTL_ADD, listener, &event);
+
+    signal(SIGINT, requestServerStop);
+    signal(SIGTERM, requestServerStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    cout << "Serving " << patientCount() << " patients on " << socketPath << "\n";
+    cout.flush();
+
+    unordered_map<int, ServerConnection> connections;
+    epoll_event ready[64];
+    static char buffer[1 << 16];
+    long long requests = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (!serverStopRequested) {
+        int count = epoll_wait(poller, ready, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int e = 0; e < count; ++e) {
+            int fd = ready[e].data.fd;
+            if (fd == listener) {
+                int client;
+                while ((client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    ServerConnection& conn = connections[client];
+                    conn.events = EPOLLIN | EPOLLRDHUP;
+                    event.events = conn.events;
+                    event.data.fd = client;
+                    epoll_ctl(poller, EPOLL_CTL_ADD, client, &event);
+                }
+                continue;
+            }
+
+            ServerConnection& conn = connections[fd];
+            bool broken = (ready[e].events & EPOLLERR) != 0;
+            if (!broken && !conn.finished && (ready[e].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                while (conn.in.size() < SERVER_MAX_PENDING_INPUT) {
+                    ssize_t n = read(fd, buffer, min(sizeof(buffer), SERVER_MAX_PENDING_INPUT - conn.in.size()));
+                    if (n > 0) {
+                        conn.in.append(buffer, (size_t)n);
+                        continue;
+                    }
+                    if (n < 0 && errno == EINTR) continue;
+                    // End of input: answer what arrived, then hang up
+                    if (n == 0) conn.finished = true;
+                    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) broken = true;
+                    break;
+                }
+            }
+
+            // Answer the complete request lines until the answers back up;
+            // the rest wait in `in` until the socket has taken them
+            bool waiting = false;
+            while (!broken) {
+                size_t begin = 0, end;
+                while ((end = conn.in.find('\n', begin)) != string::npos) {
+                    if (conn.out.size() >= SERVER_MAX_PENDING_OUTPUT) break;
+                    string_view line(conn.in.data() + begin, end - begin);
+                    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                    handleServerRequest(line, conn.out);
+                    requests++;
+                    begin = end + 1;
+                }
+                conn.in.erase(0, begin);
+                waiting = end != string::npos;
+                if (!waiting && conn.in.size() >= SERVER_MAX_PENDING_INPUT) {
+                    conn.out += "ERR|request line too long\n";
+                    conn.in.clear();
+                    conn.finished = true;
+                }
+                // Answered changes must survive a crash of the server: their
+                // journal records go out in one write before the answers do
+                if (begin > 0) waitForJournalWrites();
+                broken = !flushServerConnection(fd, conn);
+                if (!waiting || !conn.out.empty()) break;
+            }
+
+            if (broken || (conn.finished && conn.out.empty() && !waiting)) {
+                epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                connections.erase(fd);
+                continue;
+            }
+            // Wait for the socket to drain before reading more from a client
+            // that does not keep up with its answers
+            uint32_t wanted = 0;
+            if (!conn.finished && conn.out.size() < SERVER_MAX_PENDING_OUTPUT && conn.in.size() < SERVER_MAX_PENDING_INPUT) {
+                wanted |= EPOLLIN | EPOLLRDHUP;
+            }
+            if (!conn.out.empty()) wanted |= EPOLLOUT;
+            if (wanted != conn.events) {
+                conn.events = wanted;
+                event.events = wanted;
+                event.data.fd = fd;
+                epoll_ctl(poller, EPOLL_CTL_MOD, fd, &event);
+            }
+        }
+    }
+
+    for (auto& entry : connections) close(entry.first);
+    close(poller);
+    close(listener);
+    unlink(socketPath.c_str());
+
+    double seconds = secondsSince(start);
+    cout << "Answered " << requests << " requests in " << seconds << " s\n";
+    if (!writeDataFile()) {
         cout << "Failed to save data to file.\n";
-        return;
+        return 1;
+    }
+    cout << "Saved " << patientCount() << " patients to " << dataFilePath << "\n";
+    return 0;
+}
+
+// Entry point for "--loadgen <socket> [requests] [connections] [depth]".
+// Every connection runs on its own thread and keeps `depth` requests in
+// flight: 90% lookups and 10% age updates of random IDs in the synthetic
+// 1232xxxxx range. A request's latency runs from the moment its batch was
+// sent until its response arrived.
+int runLoadGenerator(const string& socketPath, long long total, int connections, int depth) {
+    const int idRange = 1000000;
+    connections = max(connections, 1);
+    depth = max(depth, 1);
+    long long perConnection = max(total / connections, 1LL);
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cout << "Socket path " << socketPath << " is too long.\n";
+        return 1;
     }
+    memcpy(address.sun_path, socketPath.data(), socketPath.size());
+
+    vector<vector<float>> latencies(connections);
+    atomic<long long> ok{0}, errors{0};
+    atomic<bool> failed{false};
+
+    auto client = [&](int c) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+            failed = true;
+            if (fd >= 0) close(fd);
+            return;
+        }
+        mt19937 rng(c + 1);
+        vector<float>& measured = latencies[c];
+        measured.reserve(perConnection);
+        string batch, in;
+        char buffer[1 << 16];
+        long long okCount = 0, errorCount = 0;
+
+        for (long long remaining = perConnection; remaining > 0 && !failed;) {
+            int n = (int)min<long long>(depth, remaining);
+            batch.clear();
+            for (int i = 0; i < n; ++i) {
+                string id = to_string(123200000 + (int)(rng() % idRange));
+                if (rng() % 10 == 0) {
+                    batch += "update|" + id + "||" + to_string(rng() % 90) + "|||||\n";
+                } else {
+                    batch += "get|" + id + "\n";
+                }
+            }
+            auto sentAt = std::chrono::steady_clock::now();
+            for (size_t done = 0; done < batch.size();) {
+                ssize_t w = send(fd, batch.data() + done, batch.size() - done, MSG_NOSIGNAL);
+                if (w <= 0) {
+                    failed = true;
+                    break;
+                }
+                done += (size_t)w;
+            }
+            for (int answered = 0; answered < n && !failed;) {
+                ssize_t r = read(fd, buffer, sizeof(buffer));
+                if (r <= 0) {
+                    failed = true;
+                    break;
+                }
+                float us = (float)(secondsSince(sentAt) * 1e6);
+                in.append(buffer, (size_t)r);
+                size_t begin = 0, end;
+                while ((end = in.find('\n', begin)) != string::npos) {
+                    if (in.compare(begin, 2, "OK") == 0) {
+                        okCount++;
+                    } else {
+                        errorCount++;
+                    }
+                    measured.push_back(us);
+                    answered++;
+                    begin = end + 1;
+                }
+                in.erase(0, begin);
+            }
+            remaining -= n;
+        }
+        ok += okCount;
+        errors += errorCount;
+        close(fd);
+    };
 
-    for (int i = 0; i < patientCount; ++i) {
-        Patient &p = patients[i][0];
-        outFile
-            << p.id << "|"
-            << p.name << "|"
-            << p.age << "|"
-            << p.gender << "|"
-            << p.blood << "|"
-            << p.phone << "|"
-            << p.cnic << "|"
-            << p.address << "|"
-            << p.diagnosis
-            << "\n";
+    auto start = std::chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int c = 0; c < connections; ++c) workers.emplace_back(client, c);
+    for (thread& worker : workers) worker.join();
+    double seconds = secondsSince(start);
+    if (failed) {
+        cout << "Lost the connection to " << socketPath << ".\n";
+        return 1;
     }
 
-    outFile.close();
+    vector<float> all;
+    for (const vector<float>& measured : latencies) all.insert(all.end(), measured.begin(), measured.end());
+    auto percentile = [&all](double q) {
+        if (all.empty()) return 0.0f;
+        size_t k = min(all.size() - 1, (size_t)(q * all.size()));
+        nth_element(all.begin(), all.begin() + k, all.end());
+        return all[k];
+    };
+    cout << "requests\t" << all.size() << " (" << ok << " ok, " << errors << " errors)\n";
+    cout << "connections\t" << connections << ", pipeline depth " << depth << "\n";
+    cout << "throughput\t" << all.size() / seconds << " requests/s\n";
+    cout << "latency p50\t" << percentile(0.50) << " us\n";
+    cout << "latency p99\t" << percentile(0.99) << " us\n";
+    return 0;
+}
+#else
+int runServer(const string& socketPath) {
+    (void)socketPath;
+    cout << "Server mode needs Linux (epoll).\n";
+    return 1;
+}
+
+int runLoadGenerator(const string& socketPath, long long total, int connections, int depth) {
+    (void)socketPath, (void)total, (void)connections, (void)depth;
+    cout << "The load generator needs Linux.\n";
+    return 1;
 }
+#endif
 
 // Helper functions for input validation
 bool isValidName(const string& name) {
@@ -317,12 +5403,6 @@ int promptValidInt(const string& prompt) {
 
 // Modified addPatient function with looping input validation for ID and other fields
 void addPatient() {
-    if (patientCount >= MAX_PATIENTS) {
-        clear();
-        cout << "Patient capacity is full.\n";
-        return;
-    }
-
     clear();
 
     Patient newP;
@@ -330,7 +5410,8 @@ void addPatient() {
     while (true) {
 
         newP.id = promptValidInt("Enter patient ID: ");
-        if (findPatientIndexByID(newP.id, 0) != -1) {
+        Patient existing;
+        if (lookupPatient(newP.id, existing)) {
             cout << "ID is already registered. Please enter a different ID.\n";
         } else {
             break;
@@ -351,17 +5432,19 @@ void addPatient() {
 
     newP.diagnosis = ""; // diagnosis is empty when adding patient
 
-    patients[patientCount][0] = newP;
-    patientCount++;
-
-    saveToFile();
+    if (insertPatient(std::move(newP)) == STORE_DUPLICATE_ID) {
+        // Another client registered the ID while this one was typing
+        clear();
+        cout << "ID is already registered. Patient not added.\n";
+        return;
+    }
     clear();
     cout << "Patient successfully added.\n";
 }
 
 // Function to add/change patient diagnosis by ID
 void diagnosePatient() {
-    if (patientCount == 0) {
+    if (patientCount() == 0) {
         clear();
         cout << "No patient data available.\n";
         return;
@@ -390,14 +5473,14 @@ void diagnosePatient() {
         break;
     }
 
-    int idx = findPatientIndexByID(id, 0);
-    if (idx == -1) {
+    Patient p;
+    if (!lookupPatient(id, p)) {
         clear();
         cout << "Patient with that ID not found.\n";
         return;
     }
 
-    if (!patients[idx][0].diagnosis.empty()) {
+    if (!p.diagnosis.empty()) {
         clear();
         cout << "Error: Patient already has a diagnosis. Please update the diagnosis through the Update Patient feature.\n";
         return;
@@ -406,46 +5489,98 @@ void diagnosePatient() {
     cout << "Enter diagnosis for patient (ID " << id << "): ";
     string diag;
     getline(cin, diag);
-    patients[idx][0].diagnosis = diag;
 
-    saveToFile();
+    StoreStatus status = diagnosePatientRecord(id, diag);
     clear();
-    cout << "Diagnosis saved successfully.\n";
+    if (status == STORE_NOT_FOUND) {
+        cout << "Patient with that ID not found.\n";
+    } else if (status == STORE_HAS_DIAGNOSIS) {
+        cout << "Error: Patient already has a diagnosis. Please update the diagnosis through the Update Patient feature.\n";
+    } else {
+        cout << "Diagnosis saved successfully.\n";
+    }
+}
+
+// Render one page of "Display All Patients" into out, which is then
+// written with a single call
+void appendListingPage(string& out, const vector<int>& rows, size_t page, size_t pages) {
+    out += "List of All Patients (page " + to_string(page) + " of " + to_string(pages) + "):\n";
+    out += "====================\n";
+    for (int i : rows) {
+        out += "ID: ";
+        out += to_string(patients.id[i]);
+        out += "\tName: ";
+        out += patients.name[i];
+        out += '\n';
+    }
+    out += "====================\n";
+}
+
+// One line of a patient listing that shows more than the name
+void appendPatientSummary(string& out, int i) {
+    out += "ID: " + to_string(patients.id[i]);
+    out += ", Name: ";
+    out += patients.name[i];
+    out += ", Age: " + to_string(patients.age[i]);
+    out += ", Gender: ";
+    out += patients.genderOf(i);
+    out += ", Blood Type: ";
+    out += patients.bloodOf(i);
+    out += '\n';
 }
 
 // Function to display summary of all patients (after sorting by ID)
 void showAllPatients(int sortChoice, bool ascending) {
-    if (patientCount == 0) {
+    if (patientCount() == 0) {
         clear();
         cout << "No patient data available.\n";
         return;
     }
+    prepareAllPatients();
 
     clear();
 
-    if (sortChoice == 1) {
-        sortPatientsByID(patientCount, ascending);
-    } else if (sortChoice == 2) {
-        sortPatientsByName(patientCount, ascending);
-    } else {
+    ListCursor cursor;
+    if (sortChoice < 1 || sortChoice > 3) {
         cout << "Invalid sort choice. Defaulting to sort by ID ascending.\n";
-        sortPatientsByID(patientCount, true);
+        sortChoice = 1;
+        ascending = true;
     }
+    cursor.byName = sortChoice == 2;
+    cursor.byAge = sortChoice == 3;
+    cursor.ascending = ascending;
 
-    cout << "List of All Patients:\n";
-    cout << "====================\n";
-    for (int i = 0; i < patientCount; ++i) {
-        Patient &p = patients[i][0];
-        cout << "ID: " << p.id << "\tName: " << p.name << "\n";
-    }
-    cout << "====================\n";
+    // Cursor at the start of every page shown so far, for going back
+    vector<ListCursor> pageStarts{cursor};
+    vector<int> rows;
+    string out, input;
+    while (true) {
+        cursor = pageStarts.back();
+        shared_lock<StoreLock> lock(storeMutex);
+        bool more = nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+        size_t pages = max((patients.size() + LISTING_PAGE_SIZE - 1) / LISTING_PAGE_SIZE, pageStarts.size());
+        out.clear();
+        appendListingPage(out, rows, pageStarts.size(), pages);
+        lock.unlock();
 
-    continueLoad();
+        clear();
+        out += more ? "[Enter] next page, " : "";
+        out += pageStarts.size() > 1 ? "[p] previous page, " : "";
+        out += "[q] back: ";
+        cout.write(out.data(), out.size());
+        cout.flush();
+        if (!getline(cin, input) || input == "q" || input == "Q") break;
+        if (input == "p" || input == "P") {
+            if (pageStarts.size() > 1) pageStarts.pop_back();
+        } else if (more) {
+            pageStarts.push_back(cursor);
+        }
+    }
 }
 
 // Function to display complete data of one patient
 void showPatientData() {
-    if (patientCount == 0) {
+    if (patientCount() == 0) {
         clear();
         cout << "No patient data available.\n";
         continueLoad();
@@ -459,8 +5594,8 @@ void showPatientData() {
     cin >> id;
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
-    int idx = findPatientIndexByID(id, 0);
-    if (idx == -1) {
+    Patient p;
+    if (!lookupPatient(id, p)) {
         clear();
         cout << "Patient with that ID not found.\n";
         continueLoad();
@@ -469,7 +5604,6 @@ void showPatientData() {
 
     clear();
 
-    Patient &p = patients[idx][0];
     cout << "Complete Patient Data (ID " << p.id << "):\n";
     cout << "------------------------------------\n";
     cout << "Name      : " << p.name << "\n";
@@ -485,9 +5619,336 @@ void showPatientData() {
     continueLoad();
 }
 
+// Dictionary code of text for a filter; text nobody has gets a code that
+// matches no row
+long long filterCode(const StringInterner& dictionary, const string& text) {
+    long long code = dictionary.find(text);
+    return code >= 0 ? code : dictionary.size();
+}
+
+// Function to list the patients matching several conditions at once
+void filterPatients() {
+    if (patientCount() == 0) {
+        clear();
+        cout << "No patient data available.\n";
+        continueLoad();
+        return;
+    }
+    prepareAllPatients();
+
+    clear();
+
+    ScanFilter filter;
+    string input, gender, blood;
+    cout << "Filter Patients (leave a field empty to accept any value)\n";
+    cout << "Minimum age: ";
+    getline(cin, input);
+    if (!input.empty() && !parseIntField(input, filter.minAge)) {
+        cout << "Invalid age.\n";
+        continueLoad();
+        return;
+    }
+    cout << "Maximum age: ";
+    getline(cin, input);
+    if (!input.empty() && !parseIntField(input, filter.maxAge)) {
+        cout << "Invalid age.\n";
+        continueLoad();
+        return;
+    }
+    cout << "Gender: ";
+    getline(cin, gender);
+    cout << "Blood type: ";
+    getline(cin, blood);
+    cout << "Only patients without a diagnosis? (y/n): ";
+    getline(cin, input);
+
+    // Codes are looked up and used under the same lock
+    shared_lock<StoreLock> lock(storeMutex);
+    if (!gender.empty()) filter.gender = filterCode(patients.genderDict, gender);
+    if (!blood.empty()) filter.blood = filterCode(patients.bloodDict, blood);
+    if (input == "y" || input == "Y") filter.diagnosis = filterCode(patients.diagnosisDict, "");
+
+    vector<uint64_t> selection;
+    long long count = scanPatients(filter, &selection);
+
+    // The listing is rendered under the lock and printed after it is released
+    string out = "Matching patients: " + to_string(count) + "\n";
+    out += "------------------------------------\n";
+    forEachSelected(selection, [&out](int i) { appendPatientSummary(out, i); });
+    lock.unlock();
+    out += "------------------------------------\n";
+
+    clear();
+    cout.write(out.data(), out.size());
+    continueLoad();
+}
+
+// Function to list the patients whose ID or age lies in a range, read off
+// the ordered ID and age indexes instead of scanning every patient
+void showPatientsInRange() {
+    if (patientCount() == 0) {
+        clear();
+        cout << "No patient data available.\n";
+        continueLoad();
+        return;
+    }
+    prepareAllPatients();
+
+    clear();
+
+    int lowestId, highestId, youngest, oldest;
+    {
+        shared_lock<StoreLock> lock(storeMutex);
+        patientBounds(lowestId, highestId, youngest, oldest);
+    }
+    cout << "Patient IDs " << lowestId << " to " << highestId << ", ages " << youngest << " to " << oldest << "\n";
+    cout << "1. ID range\n";
+    cout << "2. Age range\n";
+    cout << "Enter choice (1-2): ";
+    string input;
+    getline(cin, input);
+    bool byAge = input == "2";
+    if (!byAge && input != "1") {
+        cout << "Invalid choice.\n";
+        continueLoad();
+        return;
+    }
+
+    // An empty bound leaves that end of the range open
+    int from = INT_MIN, to = INT_MAX;
+    cout << (byAge ? "From age: " : "From ID: ");
+    getline(cin, input);
+    bool valid = input.empty() || parseIntField(input, from);
+    cout << (byAge ? "To age: " : "To ID: ");
+    getline(cin, input);
+    valid = (input.empty() || parseIntField(input, to)) && valid;
+    if (!valid) {
+        cout << (byAge ? "Invalid age.\n" : "Invalid ID.\n");
+        continueLoad();
+        return;
+    }
+
+    vector<int> ids;
+    {
+        shared_lock<StoreLock> lock(storeMutex);
+        ids = byAge ? patientIdsInAgeRange(from, to) : patientIdsInRange(from, to);
+    }
+
+    // Page through the matches like "Display All Patients". A page is
+    // rendered under the lock and printed after it is released.
+    size_t pages = max((ids.size() + LISTING_PAGE_SIZE - 1) / LISTING_PAGE_SIZE, (size_t)1);
+    size_t page = 0;
+    string out;
+    while (true) {
+        out = "Matching patients: " + to_string(ids.size()) + " (page " + to_string(page + 1) + " of " +
+              to_string(pages) + ")\n";
+        out += "------------------------------------\n";
+        size_t end = min(ids.size(), (page + 1) * LISTING_PAGE_SIZE);
+        shared_lock<StoreLock> lock(storeMutex);
+        for (size_t k = page * LISTING_PAGE_SIZE; k < end; ++k) {
+            // Skip a patient deleted since the range was read
+            int i = patients.find(ids[k]);
+            if (i != -1) appendPatientSummary(out, i);
+        }
+        lock.unlock();
+        out += "------------------------------------\n";
+
+        clear();
+        out += page + 1 < pages ? "[Enter] next page, " : "";
+        out += page > 0 ? "[p] previous page, " : "";
+        out += "[q] back: ";
+        cout.write(out.data(), out.size());
+        cout.flush();
+        if (!getline(cin, input) || input == "q" || input == "Q") break;
+        if (input == "p" || input == "P") {
+            if (page > 0) page--;
+        } else if (page + 1 < pages) {
+            page++;
+        }
+    }
+}
+
+// Function to find patients by the beginning of their name, or by a name
+// that is only roughly known
+void searchPatientsByName() {
+    if (patientCount() == 0) {
+        clear();
+        cout << "No patient data available.\n";
+        continueLoad();
+        return;
+    }
+    prepareAllPatients();
+
+    clear();
+    string mode, text;
+    cout << "Search Patients by Name\n";
+    cout << "1. Name starts with\n";
+    cout << "2. Similar names\n";
+    cout << "Enter choice (1-2): ";
+    getline(cin, mode);
+    if (mode != "1" && mode != "2") {
+        cout << "Invalid choice.\n";
+        continueLoad();
+        return;
+    }
+    cout << (mode == "1" ? "Beginning of the name: " : "Name: ");
+    getline(cin, text);
+
+    // The results are rendered under the lock and printed after it is released
+    string out = "------------------------------------\n";
+    shared_lock<StoreLock> lock(storeMutex);
+    if (mode == "1") {
+        vector<int> rows = searchNamesByPrefix(text, 20);
+        for (int i : rows) {
+            out += "ID: " + to_string(patients.id[i]) + ", Name: ";
+            out += patients.name[i];
+            out += ", Age: " + to_string(patients.age[i]) + "\n";
+        }
+        if (rows.empty()) out += "No patients found whose name starts with \"" + text + "\".\n";
+    } else {
+        vector<NameMatch> matches = searchNamesFuzzy(text, 10);
+        for (const NameMatch& match : matches) {
+            int i = match.row;
+            out += "ID: " + to_string(patients.id[i]) + ", Name: ";
+            out += patients.name[i];
+            out += ", Age: " + to_string(patients.age[i]) + " (edit distance " + to_string(match.distance) + ")\n";
+        }
+        if (matches.empty()) out += "No patients found with a name similar to \"" + text + "\".\n";
+    }
+    lock.unlock();
+    out += "------------------------------------\n";
+
+    clear();
+    cout.write(out.data(), out.size());
+    continueLoad();
+}
+
+// Report as a table: one line per group with its age aggregates and an age
+// histogram drawn as one mark per bracket, darker for more patients
+void appendReportTable(string& out, const vector<GroupField>& fields, const vector<GroupReportRow>& report) {
+    static const char marks[] = " .:-=+*#%@";
+    const size_t maxWidth = 24;
+    vector<size_t> widths;
+    for (size_t k = 0; k < fields.size(); ++k) {
+        size_t width = strlen(GROUP_FIELD_NAMES[fields[k]]);
+        for (const GroupReportRow& row : report) width = max(width, min(row.key[k].size(), maxWidth));
+        widths.push_back(width);
+    }
+    char line[160];
+    for (size_t k = 0; k < fields.size(); ++k) {
+        snprintf(line, sizeof line, "%-*s  ", (int)widths[k], GROUP_FIELD_NAMES[fields[k]]);
+        out += line;
+    }
+    snprintf(line, sizeof line, "%10s %5s %7s %5s  %s\n", "count", "min", "avg", "max",
+             ("ages 0-" + ageBracketLabel(AGE_BRACKETS - 1)).c_str());
+    out += line;
+    for (const GroupReportRow& row : report) {
+        for (size_t k = 0; k < fields.size(); ++k) {
+            const char* label = row.key[k].empty() ? "-" : row.key[k].c_str();
+            snprintf(line, sizeof line, "%-*.*s  ", (int)widths[k], (int)maxWidth, label);
+            out += line;
+        }
+        const GroupStats& s = row.stats;
+        uint64_t most = *max_element(s.histogram, s.histogram + AGE_BRACKETS);
+        char bars[AGE_BRACKETS + 1];
+        for (int b = 0; b < AGE_BRACKETS; ++b) {
+            bars[b] = s.histogram[b] == 0 ? ' ' : marks[1 + (s.histogram[b] * 8 + most - 1) / most];
+        }
+        bars[AGE_BRACKETS] = '\0';
+        snprintf(line, sizeof line, "%10llu %5d %7.1f %5d  [%s]\n", (unsigned long long)s.count, s.minAge,
+                 s.meanAge(), s.maxAge, bars);
+        out += line;
+    }
+}
+
+// Function to group patients by any of their fields and show counts and
+// age aggregates per group
+void showPatientReports() {
+    if (patientCount() == 0) {
+        clear();
+        cout << "No patient data available.\n";
+        continueLoad();
+        return;
+    }
+    prepareAllPatients();
+
+    clear();
+    string text;
+    cout << "Patient Reports\n";
+    cout << "Group by any of: age, gender, blood, diagnosis, address\n";
+    cout << "Fields (e.g. \"diagnosis, age, gender\"): ";
+    getline(cin, text);
+    vector<GroupField> fields;
+    if (!parseGroupFields(text, fields)) {
+        cout << "Unknown or repeated field.\n";
+        continueLoad();
+        return;
+    }
+
+    shared_lock<StoreLock> lock(storeMutex);
+    bool live = findAggregateView(fields) != nullptr;
+    vector<GroupReportRow> report = groupPatients(fields);
+    lock.unlock();
+
+    clear();
+    string out;
+    appendReportTable(out, fields, report);
+    out += "------------------------------------\n";
+    out += to_string(report.size()) + " groups" + (live ? " (kept up to date)" : "") + "\n";
+    cout << out;
+    if (!live) {
+        cout << "Keep this report up to date as patients change? (y/n): ";
+        string answer;
+        getline(cin, answer);
+        if (answer != "y" && answer != "Y") return;
+        unique_lock<StoreLock> writeLock(storeMutex);
+        materializeReport(fields);
+        writeLock.unlock();
+        cout << "The report will now show instantly.\n";
+    }
+    continueLoad();
+}
+
+// Function to show the runtime statistics collected since start-up
+void showStatistics() {
+    clear();
+    StatsSnapshot s = snapshotStats();
+    char line[160];
+    string out = "Statistics since start-up (latencies in microseconds)\n";
+    out += "------------------------------------------------------------\n";
+    snprintf(line, sizeof line, "%-8s %12s %10s %10s %10s %10s\n", "", "count", "mean", "p50", "p99", "max");
+    out += line;
+    for (int op = 0; op < STAT_OP_COUNT; ++op) {
+        snprintf(line, sizeof line, "%-8s %12llu %10.1f %10.1f %10.1f %10.1f\n", STAT_OP_NAMES[op],
+                 (unsigned long long)s.calls[op], s.meanNs(op) / 1e3, s.quantile(op, 0.5) / 1e3,
+                 s.quantile(op, 0.99) / 1e3, s.quantile(op, 1.0) / 1e3);
+        out += line;
+    }
+    out += "------------------------------------------------------------\n";
+    snprintf(line, sizeof line, "Read:    %.2f MB, %llu records\nWritten: %.2f MB, %llu records\n",
+             s.bytesRead / 1048576.0, (unsigned long long)s.recordsRead, s.bytesWritten / 1048576.0,
+             (unsigned long long)s.recordsWritten);
+    out += line;
+    if (!stats.enabled) out += "Statistics are off (--no-stats).\n";
+    out += "Save as JSON to " + dataFilePath + ".stats.json? (y/n): ";
+    cout << out;
+
+    string answer;
+    getline(cin, answer);
+    if (answer == "y" || answer == "Y") {
+        string path = dataFilePath + ".stats.json";
+        if (writeFileAtomically(path, statsJson() + "\n")) {
+            cout << "Statistics saved to " << path << ".\n";
+        } else {
+            cout << "Failed to write " << path << ".\n";
+        }
+        continueLoad();
+    }
+}
+
 // Function to delete patient data by ID
 void deletePatient() {
-    if (patientCount == 0) {
+    if (patientCount() == 0) {
         clear();
         cout << "No patient data available.\n";
         return;
@@ -500,26 +5961,18 @@ void deletePatient() {
     cin >> id;
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
-    int idx = findPatientIndexByID(id, 0);
-    if (idx == -1) {
+    if (removePatient(id) == STORE_NOT_FOUND) {
         clear();
         cout << "Patient with that ID not found.\n";
         return;
     }
-
-    // Shift data behind the deleted index
-    for (int i = idx; i < patientCount - 1; ++i) {
-        patients[i][0] = patients[i + 1][0];
-    }
-    patientCount--;
-    saveToFile();
     clear();
     cout << "Patient data successfully deleted.\n";
 }
 
 // Function to update patient data by ID
 void updatePatient() {
-    if (patientCount == 0) {
+    if (patientCount() == 0) {
         clear();
         cout << "No patient data available.\n";
         return;
@@ -532,8 +5985,8 @@ void updatePatient() {
     cin >> id;
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
-    int idx = findPatientIndexByID(id, 0);
-    if (idx == -1) {
+    Patient p;
+    if (!lookupPatient(id, p)) {
         clear();
         cout << "Patient with that ID not found.\n";
         return;
@@ -541,7 +5994,6 @@ void updatePatient() {
 
     clear();
 
-    Patient &p = patients[idx][0];
     cout << "Old patient data (ID " << p.id << "):\n";
     cout << "Name      : " << p.name << "\n";
     cout << "Age       : " << p.age << "\n";
@@ -587,7 +6039,12 @@ void updatePatient() {
     getline(cin, input);
     if (!input.empty()) p.diagnosis = input;
 
-    saveToFile();
+    if (replacePatient(id, std::move(p)) == STORE_NOT_FOUND) {
+        // Another client deleted the patient while this one was typing
+        clear();
+        cout << "Patient with that ID not found.\n";
+        return;
+    }
     clear();
     cout << "Patient data successfully updated.\n";
 }
@@ -601,8 +6058,12 @@ void handleDataPatientMenu() {
         cout << "3. Show Patient Data\n";
         cout << "4. Count Patients by Diagnosis\n";
         cout << "5. Search Patients by Blood Type\n";
-        cout << "6. Back to Main Menu\n";
-        cout << "Your choice (1-6): ";
+        cout << "6. Filter Patients\n";
+        cout << "7. Search Patients by Name\n";
+        cout << "8. Patient Reports\n";
+        cout << "9. Patients by ID or Age Range\n";
+        cout << "10. Back to Main Menu\n";
+        cout << "Your choice (1-10): ";
         cin >> dataChoice;
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
@@ -618,7 +6079,8 @@ void handleDataPatientMenu() {
                     cout << "Display All Patients - Sort by:\n";
                     cout << "1. ID\n";
                     cout << "2. Name\n";
-                    cout << "Enter choice (1-2): ";
+                    cout << "3. Age\n";
+                    cout << "Enter choice (1-3): ";
                     cin >> sortChoice;
                     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
@@ -635,6 +6097,7 @@ void handleDataPatientMenu() {
                     switch (sortChoice) {
                         case 1:
                         case 2:
+                        case 3:
                             showAllPatients(sortChoice, ascending);
                             break;
                         default:
@@ -650,21 +6113,21 @@ void handleDataPatientMenu() {
                 break;
             case 4:
                 {
-                    if (patientCount == 0) {
+                    if (patientCount() == 0) {
                         clear();
                         cout << "No patient data available.\n";
                         break;
                     }
+                    prepareAllPatients();
                     clear();
                     cout << "Enter diagnosis to count patients: ";
                     string diagToCount;
                     getline(cin, diagToCount);
-                    int count = 0;
-                    for (int i = 0; i < patientCount; ++i) {
-                        if (patients[i][0].diagnosis == diagToCount) {
-                            count++;
-                        }
-                    }
+                    // Length of the posting list; a diagnosis nobody has has no code
+                    shared_lock<StoreLock> lock(storeMutex);
+                    long long code = patients.diagnosisDict.find(diagToCount);
+                    size_t count = code >= 0 ? patients.diagnosisIndex.count((uint32_t)code) : 0;
+                    lock.unlock();
                     clear();
                     cout << "Number of patients with diagnosis \"" << diagToCount << "\": " << count << "\n";
                     continueLoad();
@@ -673,34 +6136,58 @@ void handleDataPatientMenu() {
                 break;
             case 5:
                 {
-                    if (patientCount == 0) {
+                    if (patientCount() == 0) {
                         clear();
                         cout << "No patient data available.\n";
                         break;
                     }
+                    prepareAllPatients();
                     clear();
                     cout << "Enter blood type to search patients: ";
                     string bloodTypeToSearch;
                     getline(cin, bloodTypeToSearch);
-                    bool found = false;
-                    cout << "Patients with blood type \"" << bloodTypeToSearch << "\":\n";
-                    cout << "------------------------------------\n";
-                    for (int i = 0; i < patientCount; ++i) {
-                        if (patients[i][0].blood == bloodTypeToSearch) {
-                            Patient &p = patients[i][0];
-                            cout << "ID: " << p.id << ", Name: " << p.name << ", Age: " << p.age << "\n";
-                            found = true;
-                        }
+                    string out = "Patients with blood type \"" + bloodTypeToSearch + "\":\n";
+                    out += "------------------------------------\n";
+                    // Visit only the matching patients, listed by ID, and
+                    // print them once the lock is released
+                    shared_lock<StoreLock> lock(storeMutex);
+                    long long code = patients.bloodDict.find(bloodTypeToSearch);
+                    vector<int> matches;
+                    if (code >= 0) matches = patients.bloodIndex.ids((uint32_t)code);
+                    sort(matches.begin(), matches.end());
+                    for (int patientId : matches) {
+                        int i = patients.find(patientId);
+                        out += "ID: " + to_string(patients.id[i]) + ", Name: ";
+                        out += patients.name[i];
+                        out += ", Age: " + to_string(patients.age[i]) + "\n";
                     }
-                    if (!found) {
-                        cout << "No patients found with blood type \"" << bloodTypeToSearch << "\".\n";
+                    lock.unlock();
+                    if (matches.empty()) {
+                        out += "No patients found with blood type \"" + bloodTypeToSearch + "\".\n";
                     }
-                    cout << "------------------------------------\n";
+                    out += "------------------------------------\n";
+                    cout.write(out.data(), out.size());
                     continueLoad();
                 }
                 clear();
                 break;
             case 6:
+                filterPatients();
+                clear();
+                break;
+            case 7:
+                searchPatientsByName();
+                clear();
+                break;
+            case 8:
+                showPatientReports();
+                clear();
+                break;
+            case 9:
+                showPatientsInRange();
+                clear();
+                break;
+            case 10:
                 // Back to main menu
                 clear();
                 break;
@@ -708,7 +6195,7 @@ void handleDataPatientMenu() {
                 cout << "Invalid choice. Please try again.\n";
                 break;
         }
-    } while (dataChoice != 6);
+    } while (dataChoice != 10);
 }
 
 void handleModifyPatientDataMenu() {
@@ -747,8 +6234,9 @@ void handleMainMenu() {
         cout << "1. Add New Patient\n";
         cout << "2. Data Patient\n";
         cout << "3. Modify Patient Data\n";
-        cout << "4. Save & Exit\n";
-        cout << "Your choice (1-4): ";
+        cout << "4. Statistics\n";
+        cout << "5. Save & Exit\n";
+        cout << "Your choice (1-5): ";
         cin >> choice;
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
@@ -765,6 +6253,10 @@ void handleMainMenu() {
                 handleModifyPatientDataMenu();
                 break;
             case 4:
+                showStatistics();
+                clear();
+                break;
+            case 5:
                 saveToFile();
                 clear();
                 cout << "Patient data has been saved. Program End\n";
@@ -773,10 +6265,1286 @@ void handleMainMenu() {
                 cout << "Invalid choice. Please try again.\n";
                 break;
         }
-    } while (choice != 4);
+    } while (choice != 5);
+}
+
+// Benchmarks fold their results into this so the timed work is not optimized away
+volatile long long benchSink = 0;
+
+// Number of operator new calls so far, for the memory benchmark. Counting
+// replaces the global operator new and delete, so only a build made with
+// -DPATIENT_COUNT_ALLOCATIONS does it.
+#ifdef PATIENT_COUNT_ALLOCATIONS
+atomic<long long> heapAllocations{0};
+
+void* operator new(size_t size) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* block = malloc(size ? size : 1)) return block;
+    throw bad_alloc();
+}
+
+// GCC cannot tell that operator new above is malloc and warns once this is
+// inlined into the standard containers
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* block) noexcept {
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+    #pragma GCC diagnostic pop
+#endif
+#endif
+
+// Peak resident set size of the process in MB (0 where unknown)
+double peakRssMegabytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// Timing helper for benchmarks and batch mode: seconds elapsed since start
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Build a plausible random patient; IDs follow the 1232xxxxx registration pattern
+Patient makeSyntheticPatient(int i, mt19937& rng) {
+    static const char* firstNames[] = {"Monkey", "Nami", "Roronoa", "Sanji", "Robin", "Usopp",
+                                       "Franky", "Brook", "Jinbe", "Boa", "Himeko", "Welt",
+                                       "Kafka", "Clara", "Bronya", "Serval", "Jing", "Bailu"};
+    static const char* lastNames[] = {"Dragon", "Bellemere", "Zoro", "Vinsmoke", "Nico",
+                                      "Sniperking", "Cutty", "Soulking", "Knight", "Hancock",
+                                      "Yang", "Rand", "Landau", "Koski", "Yuan", "Hantoro"};
+    // Blood types and diagnoses are skewed like a real patient list: most
+    // patients are O or A, half have no diagnosis yet, and a few common
+    // illnesses make up most of the rest. Weights are per 100 patients.
+    static const char* bloods[] = {"O", "A", "B", "AB"};
+    static const int bloodWeights[] = {45, 35, 15, 5};
+    static const char* genders[] = {"Male", "Female"};
+    static const char* diagnoses[] = {"", "Flu Berat", "Demam Tinggi", "Asam Lambung", "-",
+                                      "Luka Dalam", "Keracunan", "Kanker Otak"};
+    static const int diagnosisWeights[] = {50, 20, 12, 7, 5, 3, 2, 1};
+    auto pick = [&rng](const int* weights) {
+        int roll = (int)(rng() % 100), k = 0;
+        while (roll >= weights[k]) roll -= weights[k++];
+        return k;
+    };
+
+    Patient p;
+    p.id = 123200000 + i;
+    p.name = string(firstNames[rng() % 18]) + " " + lastNames[rng() % 16];
+    p.age = (int)(rng() % 90);
+    p.gender = genders[rng() % 2];
+    p.blood = bloods[pick(bloodWeights)];
+    p.phone = "08" + to_string(1000000000u + rng() % 900000000u);
+    p.cnic = "cn" + to_string(rng() % 10000000u);
+    p.address = "Street " + to_string(rng() % 5000u);
+    p.diagnosis = diagnoses[pick(diagnosisWeights)];
+    return p;
+}
+
+// Replace the store contents with n synthetic patients in shuffled ID order
+void fillSyntheticStore(int n) {
+    mt19937 rng(7);
+    vector<int> order(n);
+    for (int i = 0; i < n; ++i) order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+
+    patients.clear();
+    patients.reserve(n);
+    for (int i : order) patients.append(makeSyntheticPatient(i, rng));
+}
+
+// One record in the patients.txt layout, without the trailing newline
+string formatPatientLine(const Patient& p) {
+    return to_string(p.id) + "|" + p.name + "|" + to_string(p.age) + "|" + p.gender + "|" +
+           p.blood + "|" + p.phone + "|" + p.cnic + "|" + p.address + "|" + p.diagnosis;
+}
+
+// Write synthetic patients to path until it holds at least targetBytes.
+// Returns the number of rows written.
+long long writeSyntheticFile(const string& path, long long targetBytes, long long maxRows) {
+    mt19937 rng(11);
+    ofstream out(path, ios::out | ios::binary);
+    string buffer;
+    long long bytes = 0;
+    long long rows = 0;
+    size_t blockStart = 0;
+    while (bytes < targetBytes && rows < maxRows) {
+        buffer += formatPatientLine(makeSyntheticPatient((int)rows, rng));
+        buffer += '\n';
+        rows++;
+        if (rows % TEXT_BLOCK_ROWS != 0) continue;
+        appendBlockTrailer(buffer, blockStart, TEXT_BLOCK_ROWS);
+        blockStart = buffer.size();
+        if (buffer.size() >= (1 << 20)) {
+            out.write(buffer.data(), buffer.size());
+            bytes += buffer.size();
+            buffer.clear();
+            blockStart = 0;
+        }
+    }
+    if (rows % TEXT_BLOCK_ROWS != 0) appendBlockTrailer(buffer, blockStart, (int)(rows % TEXT_BLOCK_ROWS));
+    out.write(buffer.data(), buffer.size());
+    return rows;
+}
+
+// Ask the OS to evict a file from the page cache so the next read is cold
+void dropFileCache(const string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Micro-benchmark for the ID index: average latency of hit and miss lookups
+// over tables of the given sizes, filled with registration-style IDs
+void benchLookup(const vector<int>& sizes) {
+    const int lookups = 1000000;
+    mt19937 rng(42);
+
+    cout << "ID lookup latency (" << lookups << " lookups per run)\n";
+    cout << "records\thit ns\tmiss ns\n";
+    for (int n : sizes) {
+        IdIndex index;
+        vector<int> ids(n);
+        index.reserve(n);
+        for (int i = 0; i < n; ++i) {
+            ids[i] = 123200000 + i * 3;
+            index.insert(ids[i], i);
+        }
+
+        vector<int> probes(lookups);
+        uniform_int_distribution<int> pick(0, n - 1);
+        for (int& probe : probes) probe = ids[pick(rng)];
+
+        long long checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int probe : probes) checksum += index.find(probe);
+        double hitNs = secondsSince(start) * 1e9 / lookups;
+
+        // IDs between the registered ones are never present
+        for (int& probe : probes) probe += 1;
+        start = std::chrono::steady_clock::now();
+        for (int probe : probes) checksum += index.find(probe);
+        double missNs = secondsSince(start) * 1e9 / lookups;
+
+        cout << n << "\t" << hitNs << "\t" << missNs << "\n";
+        benchSink += checksum;
+    }
+}
+
+// Time to the first page of "Display All Patients" and per following
+// page, with the listing order built and after it has gone stale
+void benchPages(const vector<int>& sizes) {
+    const int pages = 1000;
+    cout << "Paged listing (" << pages << " pages of " << LISTING_PAGE_SIZE << ")\n";
+    cout << "records\torder\tbuild ms\tfirst page us\tnext page us\tafter changes us\n";
+    mt19937 rng(3);
+    vector<int> rows;
+    for (int n : sizes) {
+        fillSyntheticStore(n);
+        for (bool byName : {false, true}) {
+            ListCursor cursor;
+            cursor.byName = byName;
+            auto start = std::chrono::steady_clock::now();
+            nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+            double buildMs = secondsSince(start) * 1e3;
+
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < pages; ++r) {
+                ListCursor first = cursor;
+                first.started = false;
+                nextPatientPage(first, LISTING_PAGE_SIZE, rows);
+                benchSink += rows[0];
+            }
+            double firstUs = secondsSince(start) * 1e6 / pages;
+
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < pages; ++r) {
+                nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+                benchSink += rows.size();
+            }
+            double nextUs = secondsSince(start) * 1e6 / pages;
+
+            // Renames and new patients land in the recent lists
+            for (int r = 0; r < 2000; ++r) {
+                Patient p = makeSyntheticPatient(n + r, rng);
+                patients.append(p);
+                int row = patients.find(123200000 + (int)(rng() % (unsigned)n));
+                p = patients.get(row);
+                p.name += " Jr";
+                patients.set(row, p);
+            }
+            cursor.started = false;
+            start = std::chrono::steady_clock::now();
+            for (int r = 0; r < pages; ++r) {
+                nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+                benchSink += rows.size();
+            }
+            double changedUs = secondsSince(start) * 1e6 / pages;
+
+            cout << n << "\t" << (byName ? "name" : "id") << "\t" << buildMs << "\t" << firstUs << "\t" << nextUs
+                 << "\t" << changedUs << "\n";
+        }
+    }
+    patients.clear();
+}
+
+// Cold-start load of a generated patients file: the old getline/substr
+// parse versus the mapped loader that fills the store
+void benchLoad(long long megabytes) {
+    const string path = "bench_patients.txt";
+    cout << "Generating " << megabytes << " MB patient file...\n";
+    long long rows = writeSyntheticFile(path, megabytes << 20);
+
+    dropFileCache(path);
+    auto start = std::chrono::steady_clock::now();
+    {
+        // Baseline: line-by-line parse as loadFromFile used to do (parse only)
+        ifstream in(path);
+        string line;
+        string fields[9];
+        long long parsed = 0;
+        while (getline(in, line)) {
+            // Block trailers are not patients (the old format had none)
+            if (line.compare(0, 2, "#|") == 0) continue;
+            size_t pos = 0;
+            for (int i = 0; i < 8; ++i) {
+                size_t nextPos = line.find('|', pos);
+                if (nextPos == string::npos) {
+                    fields[i] = line.substr(pos);
+                    pos = line.length();
+                } else {
+                    fields[i] = line.substr(pos, nextPos - pos);
+                    pos = nextPos + 1;
+                }
+            }
+            fields[8] = pos < line.length() ? line.substr(pos) : "";
+            parsed += stoi(fields[0]) + stoi(fields[2]);
+        }
+        benchSink += parsed;
+    }
+    double getlineSec = secondsSince(start);
+
+    dropFileCache(path);
+    start = std::chrono::steady_clock::now();
+    int loaded = loadPatientsFile(path);
+    double mappedSec = secondsSince(start);
+
+    double mb = (double)(megabytes << 20) / (1 << 20);
+    cout << "rows\t" << rows << " (loaded " << loaded << ")\n";
+    cout << "getline+substr parse\t" << getlineSec << " s\t" << mb / getlineSec << " MB/s\n";
+    cout << "mapped load into store\t" << mappedSec << " s\t" << mb / mappedSec << " MB/s\n";
+
+    patients.clear();
+    remove(path.c_str());
+}
+
+// Load time of a generated patients file with 1 to 16 parser threads
+void benchParallelLoad(long long megabytes) {
+    const string path = "bench_parallel.txt";
+    cout << "Generating " << megabytes << " MB patient file...\n";
+    long long rows = writeSyntheticFile(path, megabytes << 20);
+    int savedThreads = loaderThreads;
+
+    cout << "Parallel load, " << rows << " rows (" << thread::hardware_concurrency() << " hardware threads)\n";
+    cout << "threads\tused\tload s\tMB/s\tspeedup\n";
+    double baseSec = 0;
+    int lastUsed = 0;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        loaderThreads = threads;
+        // Warm page cache: this measures parsing and merging, not the disk
+        auto start = std::chrono::steady_clock::now();
+        int loaded = loadPatientsFile(path);
+        double sec = secondsSince(start);
+        if (threads == 1) baseSec = sec;
+        benchSink += loaded;
+        // Small files and few cores cap the threads; larger requests would repeat this row
+        int used = loadThreadCount(patients.source.size);
+        if (used == lastUsed) break;
+        lastUsed = used;
+        cout << threads << "\t" << used << "\t" << sec << "\t" << megabytes / sec << "\t" << baseSec / sec << "\n";
+    }
+
+    loaderThreads = savedThreads;
+    patients.clear();
+    remove(path.c_str());
+}
+
+// Cost of recording one edited patient: a journal record versus a full
+// rewrite of the data file, at several database sizes
+void benchJournal(const vector<int>& sizes) {
+    const int edits = 2000;
+    string savedPath = dataFilePath;
+    dataFilePath = "bench_journal.txt";
+
+    cout << "Per-mutation write cost\n";
+    cout << "records\tjournal us\tfull rewrite us\n";
+    for (int n : sizes) {
+        fillSyntheticStore(n);
+        long long written;
+        writePatientsFile(dataFilePath, written);
+        resetJournal(written);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < edits; ++i) {
+            int row = i % n;
+            patients.setDiagnosis(row, "Flu Berat");
+            journalUpsert(row);
+        }
+        waitForPersistence();
+        double journalUs = secondsSince(start) * 1e6 / edits;
+
+        const int rewrites = 3;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < rewrites; ++i) writePatientsFile(dataFilePath, written);
+        double rewriteUs = secondsSince(start) * 1e6 / rewrites;
+
+        cout << n << "\t" << journalUs << "\t" << rewriteUs << "\n";
+    }
+
+    resetJournal(0);
+    closeJournal();
+    remove(journalPath().c_str());
+    remove(dataFilePath.c_str());
+    dataFilePath = savedPath;
+    patients.clear();
+}
+
+// Latency of a change as the caller sees it, with the journal and with a
+// full rewrite per change (--no-journal), followed by the time the
+// durability barrier then waits for the writer thread
+void benchPersist(int n) {
+    const int edits = 5000;
+    string savedPath = dataFilePath;
+    bool savedJournal = journal.enabled;
+    dataFilePath = "bench_persist.txt";
+    fillSyntheticStore(n);
+    long long written;
+    writePatientsFile(dataFilePath, written);
+    resetJournal(written);
+
+    cout << "Change latency seen by the caller, " << n << " records (" << edits << " edits)\n";
+    cout << "mode\tmean us\tp99 us\tmax us\tbarrier ms\n";
+    for (int mode = 0; mode < 2; ++mode) {
+        journal.enabled = mode == 0;
+        vector<double> latencies(edits);
+        mt19937 rng(21);
+        for (int i = 0; i < edits; ++i) {
+            int id = 123200000 + (int)(rng() % (unsigned)n);
+            Patient p;
+            lookupPatient(id, p);
+            p.age = (p.age + 1) % 90;
+            auto start = std::chrono::steady_clock::now();
+            replacePatient(id, std::move(p));
+            latencies[i] = secondsSince(start) * 1e6;
+        }
+        auto start = std::chrono::steady_clock::now();
+        waitForPersistence();
+        double barrierMs = secondsSince(start) * 1e3;
+        double sum = 0;
+        for (double us : latencies) sum += us;
+        sort(latencies.begin(), latencies.end());
+        cout << (mode == 0 ? "journal" : "rewrite") << "\t" << sum / edits << "\t" << latencies[edits * 99 / 100]
+             << "\t" << latencies.back() << "\t" << barrierMs << "\n";
+    }
+
+    journal.enabled = savedJournal;
+    resetJournal(0);
+    closeJournal();
+    remove(journalPath().c_str());
+    remove(dataFilePath.c_str());
+    dataFilePath = savedPath;
+    patients.clear();
+}
+
+// Save and cold-start load throughput of the text and binary formats
+void benchFormats(int n) {
+    const string textPath = "bench_formats.txt";
+    const string binaryPath = "bench_formats.bin";
+    fillSyntheticStore(n);
+
+    cout << "Text vs binary snapshot, " << n << " records\n";
+    cout << "format\tMB\tsave s\tsave MB/s\tload s\tload MB/s\n";
+    for (const string& path : {textPath, binaryPath}) {
+        fillSyntheticStore(n);
+        long long written = 0;
+        auto start = std::chrono::steady_clock::now();
+        writePatientsFile(path, written);
+        double saveSec = secondsSince(start);
+
+        dropFileCache(path);
+        start = std::chrono::steady_clock::now();
+        int loaded = loadPatientsFile(path);
+        double loadSec = secondsSince(start);
+        benchSink += loaded;
+
+        double mb = written / 1048576.0;
+        cout << (isBinaryDataPath(path) ? "binary" : "text") << "\t" << mb << "\t" << saveSec << "\t"
+             << mb / saveSec << "\t" << loadSec << "\t" << mb / loadSec << "\n";
+        patients.clear();
+        remove(path.c_str());
+    }
+}
+
+// Cost of the block checksums: a checked text save and load against the
+// same rows written without trailers, both saved through a synced temp
+// file and a rename
+void benchSave(int n) {
+    const string legacyPath = "bench_save_legacy.txt";
+    const string checkedPath = "bench_save_checked.txt";
+    fillSyntheticStore(n);
+
+    // Without trailers, as text files were written before
+    auto start = std::chrono::steady_clock::now();
+    string text;
+    long long legacyBytes = 0;
+    FILE* file = fopen((legacyPath + ".tmp").c_str(), "wb");
+    if (!file) {
+        cout << "Cannot write " << legacyPath << ".tmp\n";
+        return;
+    }
+    for (int row = 0; row < patients.rows(); ++row) {
+        if (patients.isLive(row)) appendPatientLine(text, row);
+        if (text.size() >= (1 << 20) || row + 1 == patients.rows()) {
+            fwrite(text.data(), 1, text.size(), file);
+            legacyBytes += text.size();
+            text.clear();
+        }
+    }
+    syncFile(file);
+    fclose(file);
+    replaceFile(legacyPath + ".tmp", legacyPath);
+    syncDirectoryOf(legacyPath);
+    double legacySaveSec = secondsSince(start);
+
+    long long checkedBytes = 0;
+    start = std::chrono::steady_clock::now();
+    writePatientsFile(checkedPath, checkedBytes);
+    double checkedSaveSec = secondsSince(start);
+
+    // What the checksums alone cost: hashing every byte once
+    int row = 0;
+    appendTextBlocks(text, row, SIZE_MAX);
+    start = std::chrono::steady_clock::now();
+    benchSink += hashBytes(text.data(), text.size());
+    double hashSec = secondsSince(start);
+    text = string();
+
+    // Warm page cache: this measures parsing and checking, not the disk
+    start = std::chrono::steady_clock::now();
+    int legacyLoaded = loadPatientsFile(legacyPath);
+    double legacyLoadSec = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    int checkedLoaded = loadPatientsFile(checkedPath);
+    double checkedLoadSec = secondsSince(start);
+    benchSink += legacyLoaded + checkedLoaded;
+
+    double legacyMb = legacyBytes / 1048576.0;
+    double checkedMb = checkedBytes / 1048576.0;
+    cout << "Block checksums, " << n << " records (" << thread::hardware_concurrency() << " hardware threads)\n";
+    cout << "file\tMB\tsave s\tsave MB/s\tload s\tload MB/s\n";
+    cout << "unchecked\t" << legacyMb << "\t" << legacySaveSec << "\t" << legacyMb / legacySaveSec << "\t"
+         << legacyLoadSec << "\t" << legacyMb / legacyLoadSec << "\n";
+    cout << "checked\t" << checkedMb << "\t" << checkedSaveSec << "\t" << checkedMb / checkedSaveSec << "\t"
+         << checkedLoadSec << "\t" << checkedMb / checkedLoadSec << "\n";
+    cout << "hashing alone\t" << hashSec << " s\t" << checkedMb / hashSec << " MB/s\t"
+         << 100.0 * hashSec / checkedSaveSec << "% of the checked save\n";
+    cout << "trailer bytes\t" << 100.0 * (checkedBytes - legacyBytes) / legacyBytes << "%\n";
+
+    patients.clear();
+    remove(legacyPath.c_str());
+    remove(checkedPath.c_str());
+}
+
+// Start-up and lookup cost of a data file split into 16 shards against
+// loading it whole: reading the manifest, the first lookup (which loads
+// one shard), lookups in a loaded shard, and loading every shard for a
+// scan with one thread and with one per core
+void benchShards(int n) {
+    const int shardCount = 16;
+    const int probes = 1000;
+    string savedPath = dataFilePath;
+    dataFilePath = "bench_shards.txt";
+    writeSyntheticFile(dataFilePath, LLONG_MAX, n);
+
+    auto start = std::chrono::steady_clock::now();
+    benchSink += loadPatientsFile(dataFilePath);
+    double wholeSec = secondsSince(start);
+    splitIntoShards(shardCount);
+    long long written;
+    writePatientsFile(dataFilePath, written);
+
+    cout << "Sharded storage, " << n << " records in " << patients.shards.count() << " shards ("
+         << thread::hardware_concurrency() << " hardware threads)\n";
+    cout << "whole file load\t" << wholeSec * 1e3 << " ms\n";
+    int savedThreads = loaderThreads;
+    for (int threads : {1, 0}) {
+        patients.clear();
+        loaderThreads = threads;
+        start = std::chrono::steady_clock::now();
+        readShardManifest();
+        double manifestSec = secondsSince(start);
+
+        int probe = 123200000 + n / 2;
+        start = std::chrono::steady_clock::now();
+        benchSink += findPatientIndexByID(probe);
+        double firstSec = secondsSince(start);
+        start = std::chrono::steady_clock::now();
+        for (int k = 1; k <= probes; ++k) benchSink += findPatientIndexByID(probe + k);
+        double nextSec = secondsSince(start) / probes;
+
+        start = std::chrono::steady_clock::now();
+        loadAllShards();
+        double allSec = secondsSince(start);
+        if (threads == 1) {
+            cout << "start-up (manifest)\t" << manifestSec * 1e3 << " ms\n";
+            cout << "first lookup (1 shard)\t" << firstSec * 1e3 << " ms\n";
+            cout << "lookup, shard loaded\t" << nextSec * 1e6 << " us\n";
+        }
+        cout << "load all shards, " << (threads == 1 ? "1 thread" : "1 thread per core") << "\t" << allSec * 1e3
+             << " ms\n";
+    }
+    loaderThreads = savedThreads;
+
+    for (int k = 0; k < patients.shards.count(); ++k) remove(shardPath(k).c_str());
+    remove(shardManifestPath().c_str());
+    remove(dataFilePath.c_str());
+    patients.clear();
+    patients.shards.setLayout({});
+    dataFilePath = savedPath;
+}
+
+// Start-up and lookup cost of a generated patients file opened with
+// --lazy against loading it whole: start-up by scanning the file for its
+// IDs and from the index file, lookups that read the file and lookups
+// served by the record cache, and loading the rest for a scan
+void benchLazy(long long megabytes) {
+    const int probes = 1000;
+    string savedPath = dataFilePath;
+    dataFilePath = "bench_lazy.txt";
+    cout << "Generating " << megabytes << " MB patient file...\n";
+    long long rows = writeSyntheticFile(dataFilePath, megabytes << 20);
+    remove(lazyIndexPath(dataFilePath).c_str());
+
+    // Warm page cache throughout: this measures parsing, not the disk
+    auto start = std::chrono::steady_clock::now();
+    benchSink += loadPatientsFile(dataFilePath);
+    double wholeSec = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    benchSink += openLazyPatients(dataFilePath);
+    double scanSec = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    benchSink += openLazyPatients(dataFilePath);
+    double indexSec = secondsSince(start);
+
+    mt19937 rng(5);
+    vector<int> ids(probes);
+    for (int& id : ids) id = 123200000 + (int)(rng() % rows);
+    Patient p;
+    start = std::chrono::steady_clock::now();
+    benchSink += lookupPatient(ids[0], p);
+    double firstSec = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    for (int id : ids) benchSink += lookupPatient(id, p);
+    double readSec = secondsSince(start) / probes;
+    start = std::chrono::steady_clock::now();
+    for (int id : ids) benchSink += lookupPatient(id, p);
+    double cachedSec = secondsSince(start) / probes;
+    start = std::chrono::steady_clock::now();
+    hydrateAllPatients();
+    double restSec = secondsSince(start);
+
+    cout << "Lazy loading, " << rows << " rows (" << megabytes << " MB)\n";
+    cout << "whole file load\t" << wholeSec * 1e3 << " ms\n";
+    cout << "lazy start-up, scanning IDs\t" << scanSec * 1e3 << " ms\n";
+    cout << "lazy start-up, index file\t" << indexSec * 1e3 << " ms\n";
+    cout << "first lookup\t" << firstSec * 1e6 << " us\n";
+    cout << "lookup, read from file\t" << readSec * 1e6 << " us\n";
+    cout << "lookup, cached\t" << cachedSec * 1e6 << " us\n";
+    cout << "load the rest for a scan\t" << restSec * 1e3 << " ms\n";
+
+    patients.clear();
+    remove(lazyIndexPath(dataFilePath).c_str());
+    remove(dataFilePath.c_str());
+    dataFilePath = savedPath;
+}
+
+// Memory per record and scan speed of the gender, blood and diagnosis
+// columns stored as one std::string per record versus dictionary codes
+void benchDictionary(int n) {
+    fillSyntheticStore(n);
+
+    vector<string> genderText(n), bloodText(n), diagnosisText(n);
+    for (int i = 0; i < n; ++i) {
+        genderText[i] = string(patients.genderOf(i));
+        bloodText[i] = string(patients.bloodOf(i));
+        diagnosisText[i] = string(patients.diagnosisOf(i));
+    }
+    // Strings too long for the small-string buffer own a heap block as well
+    auto heapBytes = [](const vector<string>& column) {
+        size_t bytes = 0;
+        for (const string& text : column) {
+            const char* inside = (const char*)&text;
+            if (text.data() < inside || text.data() >= inside + sizeof(string)) bytes += text.capacity() + 1;
+        }
+        return bytes;
+    };
+    double stringBytes = 3.0 * sizeof(string) +
+        (double)(heapBytes(genderText) + heapBytes(bloodText) + heapBytes(diagnosisText)) / n;
+    size_t dictionaryBytes = 0;
+    for (const StringInterner* dictionary : {&patients.genderDict, &patients.bloodDict, &patients.diagnosisDict}) {
+        dictionaryBytes += dictionary->pool.size() + dictionary->entries.size() * sizeof(StringInterner::Entry) +
+                           dictionary->table.size() * sizeof(uint32_t);
+    }
+    double codeBytes = 3.0 * sizeof(uint32_t) + (double)dictionaryBytes / n;
+
+    // Query: diagnosis "Flu Berat" and blood type "AB"
+    auto start = std::chrono::steady_clock::now();
+    long long stringMatches = 0;
+    for (int i = 0; i < n; ++i) {
+        if (diagnosisText[i] == "Flu Berat" && bloodText[i] == "AB") stringMatches++;
+    }
+    double stringMs = secondsSince(start) * 1e3;
+
+    start = std::chrono::steady_clock::now();
+    uint32_t flu = (uint32_t)patients.diagnosisDict.find("Flu Berat");
+    uint32_t ab = (uint32_t)patients.bloodDict.find("AB");
+    long long codeMatches = 0;
+    for (int i = 0; i < n; ++i) {
+        codeMatches += (patients.diagnosis[i] == flu) & (patients.blood[i] == ab);
+    }
+    double codeMs = secondsSince(start) * 1e3;
+    benchSink += stringMatches + codeMatches;
+
+    cout << "Gender/blood/diagnosis columns, " << n << " records\n";
+    cout << "layout\tbytes/record\tscan ms\tmatches\n";
+    cout << "string\t" << stringBytes << "\t" << stringMs << "\t" << stringMatches << "\n";
+    cout << "codes\t" << codeBytes << "\t" << codeMs << "\t" << codeMatches << "\n";
+    patients.clear();
+}
+
+// Filter scan throughput of every kernel set over n synthetic rows. GB/s
+// counts the bytes of the columns a filter reads.
+void benchScan(int n) {
+    fillSyntheticStore(n);
+
+    struct Query {
+        const char* name;
+        ScanFilter filter;
+        int columns;
+    };
+    vector<Query> queries(3);
+    queries[0].name = "age 30-50";
+    queries[0].filter.minAge = 30;
+    queries[0].filter.maxAge = 50;
+    queries[0].columns = 1;
+    queries[1].name = "gender+blood";
+    queries[1].filter.gender = filterCode(patients.genderDict, "Female");
+    queries[1].filter.blood = filterCode(patients.bloodDict, "AB");
+    queries[1].columns = 2;
+    queries[2].name = "no diagnosis";
+    queries[2].filter.diagnosis = filterCode(patients.diagnosisDict, "");
+    queries[2].columns = 1;
+
+    const int repeats = 20;
+    vector<uint64_t> selection;
+    cout << "Filter scans, " << n << " records (" << repeats << " runs each)\n";
+    cout << "query\tkernels\tms\tGB/s\tmatches\n";
+    for (const Query& query : queries) {
+        for (const ScanKernels* kernels : availableScanKernels()) {
+            long long matches = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeats; ++r) matches = scanPatients(query.filter, &selection, *kernels);
+            double seconds = secondsSince(start) / repeats;
+            double gigabytes = (double)n * 4 * query.columns / 1e9;
+            cout << query.name << "\t" << kernels->name << "\t" << seconds * 1e3 << "\t"
+                 << gigabytes / seconds << "\t" << matches << "\n";
+            benchSink += matches;
+        }
+    }
+    patients.clear();
+}
+
+// The core paths on generated data files of each size, reported as one
+// JSON object on standard output so runs can be compared by tools.
+// Progress goes to standard error.
+void benchSuite(const vector<int>& sizes) {
+    const string path = "bench_suite.txt";
+    const int lookups = 1000000;
+    const int queries = 1000;
+    string savedPath = dataFilePath;
+    bool savedJournal = journal.enabled;
+    dataFilePath = path;
+    journal.enabled = false;
+
+    string json = "{\"benchmark\": \"suite\", \"results\": [";
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        int n = sizes[s];
+        vector<pair<string, double>> metrics;
+        cerr << "suite: " << n << " records\n";
+
+        auto start = std::chrono::steady_clock::now();
+        writeSyntheticFile(path, LLONG_MAX, n);
+        metrics.push_back({"generate_ms", secondsSince(start) * 1e3});
+
+        // loadFromFile without its screen output; there is no journal
+        patients.clear();
+        dropFileCache(path);
+        start = std::chrono::steady_clock::now();
+        loadPatientsFile(path);
+        metrics.push_back({"load_ms", secondsSince(start) * 1e3});
+        metrics.push_back({"file_mb", patients.source.size / 1048576.0});
+
+        // findPatientIndexByID, hits and misses
+        mt19937 rng(21);
+        vector<int> probes(lookups);
+        for (int& probe : probes) probe = 123200000 + (int)(rng() % (unsigned)n);
+        long long checksum = 0;
+        start = std::chrono::steady_clock::now();
+        for (int probe : probes) checksum += findPatientIndexByID(probe);
+        metrics.push_back({"find_hit_ns", secondsSince(start) * 1e9 / lookups});
+        start = std::chrono::steady_clock::now();
+        for (int probe : probes) checksum += findPatientIndexByID(-probe);
+        metrics.push_back({"find_miss_ns", secondsSince(start) * 1e9 / lookups});
+        benchSink += checksum;
+
+        // Sorted listings: building each order, then one page
+        vector<int> rows;
+        for (bool byName : {false, true}) {
+            ListCursor cursor;
+            cursor.byName = byName;
+            start = std::chrono::steady_clock::now();
+            nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+            metrics.push_back({byName ? "sort_name_ms" : "sort_id_ms", secondsSince(start) * 1e3});
+            start = std::chrono::steady_clock::now();
+            for (int q = 0; q < queries; ++q) nextPatientPage(cursor, LISTING_PAGE_SIZE, rows);
+            metrics.push_back({byName ? "page_name_us" : "page_id_us", secondsSince(start) * 1e6 / queries});
+        }
+
+        // Count by diagnosis and list by blood type, as the menu does
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < queries; ++q) {
+            long long code = patients.diagnosisDict.find(q % 2 ? "Flu Berat" : "Kanker Otak");
+            benchSink += code >= 0 ? patients.diagnosisIndex.count((uint32_t)code) : 0;
+        }
+        metrics.push_back({"count_diagnosis_ns", secondsSince(start) * 1e9 / queries});
+        const int bloodQueries = 20;
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < bloodQueries; ++q) {
+            long long code = patients.bloodDict.find(q % 2 ? "AB" : "O");
+            vector<int> matches;
+            if (code >= 0) matches = patients.bloodIndex.ids((uint32_t)code);
+            sort(matches.begin(), matches.end());
+            benchSink += matches.size();
+        }
+        metrics.push_back({"blood_query_ms", secondsSince(start) * 1e3 / bloodQueries});
+
+        // Delete a tenth of the patients, then save what is left
+        int deletes = max(n / 10, 1);
+        start = std::chrono::steady_clock::now();
+        for (int k = 0; k < deletes; ++k) {
+            int row = findPatientIndexByID(123200000 + k * 10);
+            if (row != -1) patients.erase(row);
+        }
+        metrics.push_back({"delete_ns", secondsSince(start) * 1e9 / deletes});
+
+        start = std::chrono::steady_clock::now();
+        writeDataFile();
+        metrics.push_back({"save_ms", secondsSince(start) * 1e3});
+        metrics.push_back({"peak_rss_mb", peakRssMegabytes()});
+
+        json += s == 0 ? "\n" : ",\n";
+        json += "  {\"records\": " + to_string(n);
+        for (const auto& metric : metrics) {
+            char value[32];
+            snprintf(value, sizeof value, "%.3f", metric.second);
+            json += ", \"" + metric.first + "\": " + value;
+        }
+        json += "}";
+        patients.clear();
+    }
+    json += "\n]}\n";
+    cout << json;
+
+    remove(path.c_str());
+    dataFilePath = savedPath;
+    journal.enabled = savedJournal;
+}
+
+// Cost of the runtime statistics on the cheapest instrumented operation,
+// a lookup, and on updates. Rounds with statistics on and off alternate so
+// drift in the machine hits both alike, and the fastest round of each
+// counts, which keeps scheduler noise out of the comparison.
+void benchStats(int n) {
+    const int rounds = 15;
+    const int lookups = 500000;
+    const int updates = 50000;
+    bool savedJournal = journal.enabled;
+    journal.enabled = false;
+    fillSyntheticStore(n);
+    mt19937 rng(13);
+    vector<int> probes(lookups);
+    for (int& probe : probes) probe = 123200000 + (int)(rng() % (unsigned)n);
+    vector<string> commands(updates);
+    for (int k = 0; k < updates; ++k) {
+        commands[k] = "update|" + to_string(probes[k]) + "||" + to_string(k % 90) + "||||||";
+    }
+
+    double seconds[2][2] = {{1e9, 1e9}, {1e9, 1e9}}; // [enabled][lookup, update]
+    Patient p;
+    string error;
+    for (int r = 0; r < rounds * 2; ++r) {
+        stats.enabled = r % 2 == 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int probe : probes) benchSink += lookupPatient(probe, p);
+        seconds[stats.enabled][0] = min(seconds[stats.enabled][0], secondsSince(start));
+        start = std::chrono::steady_clock::now();
+        for (const string& command : commands) benchSink += applyBatchCommand(command, error);
+        seconds[stats.enabled][1] = min(seconds[stats.enabled][1], secondsSince(start));
+    }
+    stats.enabled = true;
+
+    cout << "Runtime statistics overhead, " << n << " records (fastest of " << rounds << " rounds each)\n";
+    cout << "operation\toff ns\ton ns\toverhead %\n";
+    const char* names[] = {"lookup", "update"};
+    const int counts[] = {lookups, updates};
+    for (int k = 0; k < 2; ++k) {
+        double off = seconds[0][k] * 1e9 / counts[k];
+        double on = seconds[1][k] * 1e9 / counts[k];
+        cout << names[k] << "\t" << off << "\t" << on << "\t" << (on - off) / off * 100 << "\n";
+    }
+    patients.clear();
+    journal.enabled = savedJournal;
+}
+
+// Report latency for a few field sets: hash aggregation on one thread and
+// on all hardware threads, then read out of a materialized report. Also
+// the cost of keeping all of those reports up to date on updates.
+void benchGroupBy(int n) {
+    static const char* reports[] = {"diagnosis", "age, gender", "diagnosis, age, gender", "blood, address"};
+    const int repeats = 5;
+    const int updates = 50000;
+    bool savedJournal = journal.enabled;
+    int savedThreads = loaderThreads;
+    journal.enabled = false;
+    fillSyntheticStore(n);
+
+    cout << "Group-by reports, " << n << " records (best of " << repeats << " runs, "
+         << thread::hardware_concurrency() << " hardware threads)\n";
+    cout << "fields\tgroups\t1 thread ms\tall threads ms\tmaterialize ms\tmaterialized us\n";
+    for (const char* text : reports) {
+        vector<GroupField> fields;
+        parseGroupFields(text, fields);
+        double best[2] = {1e9, 1e9};
+        size_t groups = 0;
+        for (int mode = 0; mode < 2; ++mode) {
+            loaderThreads = mode == 0 ? 1 : 0;
+            for (int r = 0; r < repeats; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                groups = groupPatients(fields).size();
+                best[mode] = min(best[mode], secondsSince(start));
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        materializeReport(fields);
+        double buildMs = secondsSince(start) * 1e3;
+        double readUs = 1e9;
+        for (int r = 0; r < repeats; ++r) {
+            start = std::chrono::steady_clock::now();
+            benchSink += groupPatients(fields).size();
+            readUs = min(readUs, secondsSince(start) * 1e6);
+        }
+        cout << text << "\t" << groups << "\t" << best[0] * 1e3 << "\t" << best[1] * 1e3 << "\t" << buildMs << "\t"
+             << readUs << "\n";
+    }
+    loaderThreads = savedThreads;
+
+    mt19937 rng(17);
+    vector<string> commands(updates);
+    for (int k = 0; k < updates; ++k) {
+        commands[k] = "update|" + to_string(123200000 + (int)(rng() % (unsigned)n)) + "||" + to_string(k % 90) +
+                      "|||||Street " + to_string(k % 100) + "|";
+    }
+    double seconds[2];
+    string error;
+    vector<AggregateView> views = std::move(patients.aggregates.views);
+    for (int withViews = 0; withViews < 2; ++withViews) {
+        if (withViews) {
+            // The first pass changed patients behind the views' back
+            patients.aggregates.views = std::move(views);
+            patients.aggregates.rebuild(patients);
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (const string& command : commands) benchSink += applyBatchCommand(command, error);
+        seconds[withViews] = secondsSince(start);
+    }
+    cout << "update ns without reports\t" << seconds[0] * 1e9 / updates << "\n";
+    cout << "update ns with " << patients.aggregates.views.size() << " reports\t" << seconds[1] * 1e9 / updates << "\n";
+
+    patients.aggregates.views.clear();
+    patients.clear();
+    journal.enabled = savedJournal;
+}
+
+// ID and age range queries and min/max through the ordered ID and age
+// indexes against a scan of every patient that sorts its matches
+void benchRange(int n) {
+    const int repeats = 5;
+    fillSyntheticStore(n);
+    int firstId = 123200000 + n / 2;
+    struct RangeQuery {
+        const char* name;
+        bool byAge;
+        int from, to;
+    };
+    RangeQuery queries[] = {{"IDs, 100", false, firstId, firstId + 99},
+                            {"IDs, 1%", false, firstId, firstId + n / 100 - 1},
+                            {"ages 60-64", true, 60, 64},
+                            {"ages 60+", true, 60, INT_MAX}};
+
+    auto start = std::chrono::steady_clock::now();
+    benchSink += patientIdsInRange(0, -1).size();
+    double idBuildMs = secondsSince(start) * 1e3;
+    start = std::chrono::steady_clock::now();
+    benchSink += patientIdsInAgeRange(0, -1).size();
+    double ageBuildMs = secondsSince(start) * 1e3;
+
+    cout << "Range queries, " << n << " records (best of " << repeats << " runs)\n";
+    cout << "ID order build\t" << idBuildMs << " ms\n";
+    cout << "age order build\t" << ageBuildMs << " ms\n";
+    cout << "query\tpatients\tindex ms\tscan ms\n";
+    for (const RangeQuery& q : queries) {
+        double indexMs = 1e9, scanMs = 1e9;
+        size_t found = 0;
+        for (int r = 0; r < repeats; ++r) {
+            start = std::chrono::steady_clock::now();
+            found = (q.byAge ? patientIdsInAgeRange(q.from, q.to) : patientIdsInRange(q.from, q.to)).size();
+            indexMs = min(indexMs, secondsSince(start) * 1e3);
+
+            start = std::chrono::steady_clock::now();
+            vector<uint64_t> keys;
+            for (int i = 0; i < patients.rows(); ++i) {
+                int value = q.byAge ? patients.age[i] : patients.id[i];
+                if (patients.isLive(i) && value >= q.from && value <= q.to) {
+                    keys.push_back(ageOrderKey(q.byAge ? patients.age[i] : 0, patients.id[i]));
+                }
+            }
+            sort(keys.begin(), keys.end());
+            benchSink += keys.size();
+            scanMs = min(scanMs, secondsSince(start) * 1e3);
+        }
+        cout << q.name << "\t" << found << "\t" << indexMs << "\t" << scanMs << "\n";
+    }
+
+    double indexUs = 1e9, scanUs = 1e9;
+    for (int r = 0; r < repeats; ++r) {
+        int bounds[4];
+        start = std::chrono::steady_clock::now();
+        benchSink += patientBounds(bounds[0], bounds[1], bounds[2], bounds[3]);
+        indexUs = min(indexUs, secondsSince(start) * 1e6);
+        start = std::chrono::steady_clock::now();
+        benchSink += *min_element(patients.id.begin(), patients.id.end()) +
+                     *max_element(patients.id.begin(), patients.id.end()) +
+                     *min_element(patients.age.begin(), patients.age.end()) +
+                     *max_element(patients.age.begin(), patients.age.end());
+        scanUs = min(scanUs, secondsSince(start) * 1e6);
+    }
+    cout << "min/max ID and age\t4\t" << indexUs / 1e3 << "\t" << scanUs / 1e3 << "\n";
+    patients.clear();
+}
+
+// Name index build time and prefix/fuzzy name search latency. Every
+// query asks for the repo's default result counts (20 and 10).
+void benchNames(const vector<int>& sizes) {
+    static const char* prefixes[] = {"r", "ro", "roronoa", "roronoa z", "bai", "nami bel", "x"};
+    static const char* typos[] = {"roronao zoro", "nmai bellemre", "kafak", "monky dragon", "brnoya rand"};
+    const int repeats = 200;
+
+    cout << "Name search (" << repeats << " runs per query)\n";
+    cout << "records\tbuild ms\tprefix us\tfuzzy us\n";
+    for (int n : sizes) {
+        fillSyntheticStore(n);
+        auto start = std::chrono::steady_clock::now();
+        benchSink += searchNamesByPrefix("", 1).size();
+        double buildMs = secondsSince(start) * 1e3;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (const char* prefix : prefixes) benchSink += searchNamesByPrefix(prefix, 20).size();
+        }
+        double prefixUs = secondsSince(start) * 1e6 / (repeats * 7);
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) {
+            for (const char* typo : typos) benchSink += searchNamesFuzzy(typo, 10).size();
+        }
+        double fuzzyUs = secondsSince(start) * 1e6 / (repeats * 5);
+
+        cout << n << "\t" << buildMs << "\t" << prefixUs << "\t" << fuzzyUs << "\n";
+    }
+    patients.clear();
+}
+
+// Heap allocations and peak memory of adding n patients one by one, the
+// way typed-in patients and replayed journal records enter the store.
+// Allocations made while generating the records are not counted.
+void benchMemory(int n) {
+    mt19937 rng(9);
+    patients.clear();
+    patients.reserve(n);
+    double baseMb = peakRssMegabytes();
+#ifdef PATIENT_COUNT_ALLOCATIONS
+    long long storeAllocations = 0;
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        Patient p = makeSyntheticPatient(i, rng);
+#ifdef PATIENT_COUNT_ALLOCATIONS
+        long long before = heapAllocations.load(memory_order_relaxed);
+        patients.append(std::move(p));
+        storeAllocations += heapAllocations.load(memory_order_relaxed) - before;
+#else
+        patients.append(std::move(p));
+#endif
+    }
+    double seconds = secondsSince(start);
+
+    cout << "Adding " << n << " patients\n";
+#ifdef PATIENT_COUNT_ALLOCATIONS
+    cout << "allocations\t" << storeAllocations << " (" << (double)storeAllocations / n << " per patient)\n";
+#else
+    cout << "allocations\tnot counted (build with -DPATIENT_COUNT_ALLOCATIONS)\n";
+#endif
+    cout << "peak RSS\t" << peakRssMegabytes() << " MB (" << peakRssMegabytes() - baseMb << " MB for the store)\n";
+    cout << "time\t" << seconds << " s\n";
+    patients.clear();
+}
+
+// Bulk delete: remove half of the patients in random order, then add as
+// many new ones (which reuse the dead rows). Reports the average cost per
+// operation, compactions included.
+void benchDelete(const vector<int>& sizes) {
+    cout << "Bulk delete and re-add\n";
+    cout << "records\tdelete ns\tadd ns\tcompactions\n";
+    for (int n : sizes) {
+        fillSyntheticStore(n);
+        mt19937 rng(5);
+        vector<int> victims(patients.id.begin(), patients.id.end());
+        shuffle(victims.begin(), victims.end(), rng);
+        victims.resize(n / 2);
+
+        int compactions = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int patientId : victims) {
+            int rowsBefore = patients.rows();
+            patients.erase(patients.find(patientId));
+            compactions += patients.rows() != rowsBefore;
+        }
+        double deleteNs = secondsSince(start) * 1e9 / victims.size();
+
+        vector<Patient> added;
+        added.reserve(victims.size());
+        for (size_t i = 0; i < victims.size(); ++i) added.push_back(makeSyntheticPatient(n + (int)i, rng));
+        start = std::chrono::steady_clock::now();
+        for (Patient& p : added) patients.append(std::move(p));
+        double addNs = secondsSince(start) * 1e9 / added.size();
+
+        cout << n << "\t" << deleteNs << "\t" << addNs << "\t" << compactions << "\n";
+        benchSink += patients.size();
+    }
+    patients.clear();
+}
+
+// Read and write throughput of the store layer with many client threads.
+// Readers look up random patients; writers, one for every four readers,
+// change the age of random patients, journal record included.
+void benchConcurrency(int n) {
+    const int runMs = 500;
+    string savedPath = dataFilePath;
+    dataFilePath = "bench_concurrency.txt";
+    fillSyntheticStore(n);
+    long long written;
+    writePatientsFile(dataFilePath, written);
+    resetJournal(written);
+
+    cout << "Concurrent store access, " << n << " records (" << runMs << " ms per run)\n";
+    cout << "readers\twriters\treads/s\twrites/s\n";
+    for (int readers : {1, 2, 4, 8, 16}) {
+        int writers = max(readers / 4, 1);
+        atomic<bool> stop{false};
+        atomic<long long> reads{0}, writes{0};
+        vector<thread> clients;
+        for (int t = 0; t < readers + writers; ++t) {
+            bool writer = t >= readers;
+            clients.emplace_back([&, writer, t]() {
+                mt19937 rng(t + 1);
+                long long done = 0;
+                Patient p;
+                while (!stop) {
+                    int id = 123200000 + (int)(rng() % (unsigned)n);
+                    if (!writer) {
+                        benchSink += lookupPatient(id, p);
+                    } else if (lookupPatient(id, p)) {
+                        p.age = (p.age + 1) % 90;
+                        replacePatient(id, std::move(p));
+                    }
+                    done++;
+                }
+                (writer ? writes : reads) += done;
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(runMs));
+        stop = true;
+        for (thread& client : clients) client.join();
+        double seconds = runMs / 1000.0;
+        cout << readers << "\t" << writers << "\t" << reads / seconds << "\t" << writes / seconds << "\n";
+    }
+
+    resetJournal(0);
+    closeJournal();
+    remove(journalPath().c_str());
+    remove(journalOldPath().c_str());
+    remove(dataFilePath.c_str());
+    dataFilePath = savedPath;
+    patients.clear();
+}
+
+// Entry point for "--bench <name> [sizes...]"
+void runBenchmark(int argc, char* argv[]) {
+    string name = argc > 2 ? argv[2] : "";
+    vector<int> sizes;
+    for (int i = 3; i < argc; ++i) sizes.push_back(atoi(argv[i]));
+
+    if (name == "lookup") {
+        if (sizes.empty()) sizes = {10000, 1000000, 10000000};
+        benchLookup(sizes);
+    } else if (name == "pages") {
+        if (sizes.empty()) sizes = {10000, 1000000};
+        benchPages(sizes);
+    } else if (name == "load") {
+        benchLoad(sizes.empty() ? 1024 : sizes[0]);
+    } else if (name == "parallel") {
+        benchParallelLoad(sizes.empty() ? 2048 : sizes[0]);
+    } else if (name == "journal") {
+        if (sizes.empty()) sizes = {10000, 100000, 1000000};
+        benchJournal(sizes);
+    } else if (name == "persist") {
+        benchPersist(sizes.empty() ? 100000 : sizes[0]);
+    } else if (name == "formats") {
+        benchFormats(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "save") {
+        benchSave(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "shards") {
+        benchShards(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "lazy") {
+        benchLazy(sizes.empty() ? 1024 : sizes[0]);
+    } else if (name == "dict") {
+        benchDictionary(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "scan") {
+        benchScan(sizes.empty() ? 10000000 : sizes[0]);
+    } else if (name == "delete") {
+        if (sizes.empty()) sizes = {10000, 100000, 1000000};
+        benchDelete(sizes);
+    } else if (name == "memory") {
+        benchMemory(sizes.empty() ? 10000000 : sizes[0]);
+    } else if (name == "concurrency") {
+        benchConcurrency(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "names") {
+        if (sizes.empty()) sizes = {10000, 100000, 1000000};
+        benchNames(sizes);
+    } else if (name == "stats") {
+        benchStats(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "groupby") {
+        benchGroupBy(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "range") {
+        benchRange(sizes.empty() ? 1000000 : sizes[0]);
+    } else if (name == "suite") {
+        if (sizes.empty()) sizes = {10000, 1000000, 10000000};
+        benchSuite(sizes);
+    } else {
+        cout << "Unknown benchmark \"" << name << "\". Available: lookup, pages, load, parallel, journal, persist, formats, save, shards, lazy, dict, scan, delete, memory, concurrency, names, suite, stats, groupby, range\n";
+    }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        runBenchmark(argc, argv);
+        return 0;
+    }
+    if (argc == 4 && string(argv[1]) == "--generate") {
+        // Write a synthetic data file with the given number of patients
+        long long rows = writeSyntheticFile(argv[2], LLONG_MAX, max(atoll(argv[3]), 0LL));
+        cout << "Wrote " << rows << " patients to " << argv[2] << ".\n";
+        return 0;
+    }
+    if (argc == 4 && string(argv[1]) == "--convert") {
+        // Convert between patients.txt and the binary snapshot format
+        if (!convertPatientsFile(argv[2], argv[3])) {
+            cout << "Failed to convert " << argv[2] << " to " << argv[3] << ".\n";
+            return 1;
+        }
+        cout << "Converted " << patients.size() << " patients to " << argv[3] << ".\n";
+        return 0;
+    }
+    if (argc >= 3 && string(argv[1]) == "--loadgen") {
+        // Drive a running server: requests, connections, pipeline depth
+        long long total = argc > 3 ? atoll(argv[3]) : 1000000;
+        int connections = argc > 4 ? atoi(argv[4]) : 4;
+        int depth = argc > 5 ? atoi(argv[5]) : 32;
+        return runLoadGenerator(argv[2], total, connections, depth);
+    }
+    string batchPath, servePath;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--batch") {
+            // Apply commands from a file, or from standard input without one
+            batchPath = "-";
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || string(argv[i + 1]) == "-")) batchPath = argv[++i];
+        } else if (arg == "--serve") {
+            // Serve local clients on a Unix domain socket
+            servePath = "patients.sock";
+            if (i + 1 < argc && argv[i + 1][0] != '-') servePath = argv[++i];
+        } else if (arg == "--no-stats") {
+            // Skip the runtime statistics on every operation
+            stats.enabled = false;
+        } else if (arg == "--no-journal") {
+            // Rewrite the whole data file after every change instead of journaling
+            journal.enabled = false;
+        } else if (arg == "--data" && i + 1 < argc) {
+            // Use another data file; a ".bin" name selects the binary format
+            dataFilePath = argv[++i];
+        } else if (arg == "--shards" && i + 1 < argc) {
+            // Split the data file into this many shard files by ID range
+            requestedShards = max(atoi(argv[++i]), 0);
+        } else if (arg == "--lazy") {
+            // Start without parsing the data file; read records on demand
+            lazyStartup = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            // Threads for loading a text data file and for reports; 0 = all cores
+            loaderThreads = max(atoi(argv[++i]), 0);
+        }
+    }
+
+    if (!batchPath.empty()) return runBatch(batchPath);
+    if (!servePath.empty()) return runServer(servePath);
+
     // Load patient data from file when program starts
     loadFromFile();
     handleMainMenu();